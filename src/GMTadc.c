@@ -15,18 +15,113 @@
 #include <zephyr/devicetree.h>	    /* for DT_NODELABEL() */
 #include <zephyr/drivers/gpio.h>    /* for GPIO API*/
 #include <zephyr/drivers/adc.h>     /* for ADC API*/
+#include <zephyr/sys/atomic.h>
 #include <zephyr/sys/printk.h>      /* for printk()*/
-#include <hal/nrf_saadc.h>
 #include <string.h>
 #include <stdio.h>
 #include "GMTadc.h"
 #include "rtdb.h"
+#include "GMTlog.h"
+#include "GMTdsp.h"
+#if ADC_HR_COUNTER
+#include <zephyr/drivers/counter.h> /* for counter API*/
+#endif
+#if ADC_HR_COUNTER && defined(CONFIG_ADC_NRFX_SAADC)
+#include <hal/nrf_timer.h>
+#include <helpers/nrfx_gppi.h>
+#define ADC_HR_PPI 1 /* the counter's TIMER triggers the SAADC itself */
+#else
+#define ADC_HR_PPI 0
+#endif
 const struct device *adc_dev = DEVICE_DT_GET(ADC_NODE);	
 
+static uint16_t adc_scan_buffer[ADC_OVERSAMPLE * NUM_CHANNELS]; /**< Results of the scan sequence, scan after scan */
+
+static const struct adc_sequence_options adc_scan_options = {
+	.interval_us = 0, /* back to back */
+	.extra_samplings = ADC_OVERSAMPLE - 1,
+};
+
+/* Per-channel conversion: nominal multiplier scaled by the channel gain, then offset */
+static uint32_t adc_mv_mult[NUM_CHANNELS] = {
+	[0 ... NUM_CHANNELS - 1] = ADC_MV_MULT,
+};
+static int16_t adc_mv_offset[NUM_CHANNELS];
+
+BUILD_ASSERT(ADC_MV_MULT <= UINT32_MAX, "ADC conversion multiplier does not fit in 32 bits");
+
+/* Streaming acquisition: two block buffers, one being filled by the ADC while the other is published */
+static uint16_t adc_stream_buffer[2][ADC_STREAM_BLOCK][NUM_CHANNELS];
+static uint32_t adc_stream_time[2]; /**< Time of the first scan of each block (in us) */
+static int adc_stream_idx; /**< Buffer currently being filled */
+static struct k_poll_signal adc_stream_signal;
+static struct k_poll_event adc_stream_event;
+
+static enum adc_action adc_stream_cb(const struct device *dev, const struct adc_sequence *sequence, uint16_t sampling_index);
+
+static const struct adc_sequence_options adc_stream_options[2] = {
+	{.interval_us = ADC_STREAM_INTERVAL_US, .callback = adc_stream_cb, .user_data = &adc_stream_time[0], .extra_samplings = ADC_STREAM_BLOCK - 1},
+	{.interval_us = ADC_STREAM_INTERVAL_US, .callback = adc_stream_cb, .user_data = &adc_stream_time[1], .extra_samplings = ADC_STREAM_BLOCK - 1},
+};
+
+static const struct adc_sequence adc_stream_sequence[2] = {
+	{.options = &adc_stream_options[0], .channels = ADC_SCAN_MASK, .buffer = adc_stream_buffer[0], .buffer_size = sizeof(adc_stream_buffer[0]), .resolution = ADC_RESOLUTION},
+	{.options = &adc_stream_options[1], .channels = ADC_SCAN_MASK, .buffer = adc_stream_buffer[1], .buffer_size = sizeof(adc_stream_buffer[1]), .resolution = ADC_RESOLUTION},
+};
+
+/* High-rate acquisition: two block buffers like the streaming mode. Paced by the counter, the
+ * TIMER triggers the SAADC over PPI and the analog thread only wakes up for full blocks (the other
+ * ADCs scan from the thread, released by the counter); paced by the ADC driver's timer, the
+ * analog thread also only wakes up for full blocks */
+static uint16_t adc_hr_buffer[2][ADC_HR_BLOCK][NUM_CHANNELS];
+static uint32_t adc_hr_time[2]; /**< Time of the first scan of each block (in us) */
+static volatile uint32_t adc_hr_period_us; /**< Period in use, rounded to the counter or kernel tick; 0 when the mode is not selected */
+static atomic_t adc_hr_missed_count;
+#if ADC_HR_COUNTER
+static const struct device *const adc_hr_counter = DEVICE_DT_GET(ADC_HR_COUNTER_NODE);
+static atomic_t adc_hr_scans; /**< Scans triggered since the counter was started */
+static K_SEM_DEFINE(adc_hr_tick, 0, 1);
+#if ADC_HR_PPI
+static uint8_t adc_hr_ppi[2]; /**< PPI channels: TIMER compare to SAADC sample, SAADC end to SAADC start */
+static bool adc_hr_ppi_ready;
+#else
+static struct counter_alarm_cfg adc_hr_alarm; /**< Next scan, on the counter's own grid */
+static uint32_t adc_hr_alarm_ticks; /**< Period (in counter ticks) */
+static uint32_t adc_hr_counter_top; /**< The counter wraps after this value */
+#endif
+#else
+static uint32_t adc_hr_time_last[2]; /**< Time of the last scan of each block (in us) */
+static uint16_t adc_hr_count[2]; /**< Scans in each block, fewer if the mode was left mid-block */
+static struct adc_sequence_options adc_hr_options[2];
+static struct adc_sequence adc_hr_sequence[2];
+static struct k_poll_signal adc_hr_signal;
+static struct k_poll_event adc_hr_event;
+#endif
+
+/* Sampling plan: mask of the channels due on each tick of the hyperperiod. Rebuilt in the idle
+ * copy by adc_prepare_channel_period() and switched in one store by adc_commit_channel_period(),
+ * read once per tick by adc_collect(). Only the command context changes the plan. The position
+ * in the plan lives in its copy: a prepared plan starts at its first tick however many commits
+ * land between two collects. */
+BUILD_ASSERT(NUM_CHANNELS <= 8, "sampling plan masks are 8 bits wide");
+struct adc_plan {
+	uint8_t mask[ADC_PLAN_MAX];
+	uint8_t len;
+	uint8_t tick; /**< Next tick, advanced by adc_collect() */
+};
+BUILD_ASSERT(ADC_PLAN_MAX <= UINT8_MAX, "plan positions are 8 bits wide");
+static uint32_t adc_ch_period_ms[NUM_CHANNELS]; /**< 0: every tick */
+static uint32_t adc_ch_period_next[NUM_CHANNELS]; /**< Periods of the prepared plan */
+static bool adc_plan_prepared; /**< The idle plan holds a plan not committed yet */
+static struct adc_plan adc_plan[2] = {{.mask = {ADC_SCAN_MASK}, .len = 1}};
+static atomic_t adc_plan_sel;
+
 void adc_init(void) 
 {
+#ifdef CONFIG_ADC_NRFX_SAADC
     /* It is recommended to calibrate the SAADC at least once before use, and whenever the ambient temperature has changed by more than 10 °C */
 	NRF_SAADC->TASKS_CALIBRATEOFFSET = 1;
+#endif
     printk("\n\r ADC SETUP PROCESS\n\r");
 	printk(" Reads an analog input connected to AN 1-4 and stores the raw and mV value \n\r");
 	printk(" *** ASSURE THAT ANx IS BETWEEN [0...3V]\n\r");
@@ -40,6 +135,109 @@ void adc_init(void)
     }
 }
 
+int adc_set_calibration(int cid, uint16_t gain, int16_t offset_mv)
+{
+	uint64_t mult = (ADC_MV_MULT * gain) >> 14;
+
+	if (cid < 0 || cid >= NUM_CHANNELS || mult > UINT32_MAX) {
+		return -EINVAL;
+	}
+	adc_mv_mult[cid] = (uint32_t)mult;
+	adc_mv_offset[cid] = offset_mv;
+	return 0;
+}
+
+void adc_convert_block(int cid, const uint16_t *raw, size_t stride, uint16_t *mv, size_t n)
+{
+	const uint32_t mult = adc_mv_mult[cid];
+	const int32_t offset = adc_mv_offset[cid];
+
+	/* No branches in the loop body: one multiply, shift, add and saturate per sample */
+	for (size_t j = 0; j < n; j++) {
+		int32_t v = (int32_t)(((uint64_t)raw[j * stride] * mult) >> ADC_MV_SHIFT) + offset;
+		mv[j] = (uint16_t)CLAMP(v, 0, UINT16_MAX);
+	}
+}
+
+static uint32_t adc_gcd(uint32_t a, uint32_t b)
+{
+	while (b != 0) {
+		uint32_t r = a % b;
+
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+int adc_prepare_channel_period(int cid, uint32_t period_ms)
+{
+	uint32_t period[NUM_CHANNELS];
+	uint32_t tick = 0, len = 1;
+	int next = !atomic_get(&adc_plan_sel);
+
+	if (cid < 0 || cid >= NUM_CHANNELS) {
+		return -EINVAL;
+	}
+	memcpy(period, adc_ch_period_ms, sizeof(period));
+	period[cid] = period_ms;
+
+	/* Tick: gcd of the periods; hyperperiod: lcm of the periods, in ticks */
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		tick = adc_gcd(tick, period[i]);
+	}
+	for (int i = 0; i < NUM_CHANNELS && tick != 0; i++) {
+		uint32_t div = period[i] ? period[i] / tick : 1;
+
+		len = len / adc_gcd(len, div) * div;
+		if (len > ADC_PLAN_MAX) {
+			return -EINVAL;
+		}
+	}
+
+	/* The idle plan is not read by adc_collect() until adc_commit_channel_period() */
+	for (uint32_t k = 0; k < len; k++) {
+		uint8_t mask = 0;
+
+		for (int i = 0; i < NUM_CHANNELS; i++) {
+			if (period[i] == 0 || k % (period[i] / tick) == 0) {
+				mask |= BIT(i);
+			}
+		}
+		adc_plan[next].mask[k] = mask & ADC_SCAN_MASK;
+	}
+	adc_plan[next].len = len;
+	adc_plan[next].tick = 0;
+	memcpy(adc_ch_period_next, period, sizeof(period));
+	adc_plan_prepared = true;
+	return tick;
+}
+
+void adc_commit_channel_period(void)
+{
+	if (!adc_plan_prepared) {
+		return;
+	}
+	adc_plan_prepared = false;
+	memcpy(adc_ch_period_ms, adc_ch_period_next, sizeof(adc_ch_period_ms));
+	atomic_set(&adc_plan_sel, !atomic_get(&adc_plan_sel));
+}
+
+int adc_set_channel_period(int cid, uint32_t period_ms)
+{
+	int tick = adc_prepare_channel_period(cid, period_ms);
+
+	if (tick >= 0) {
+		adc_commit_channel_period();
+	}
+	return tick;
+}
+
+uint32_t adc_channel_period(int cid)
+{
+	return (cid >= 0 && cid < NUM_CHANNELS) ? adc_ch_period_ms[cid] : 0;
+}
+
 /* Takes one sample */
 int adc_sample(int cid)
 {		
@@ -65,36 +263,594 @@ int adc_sample(int cid)
 	return ret;
 }
 
+int adc_sample_mv(int cid, uint16_t *raw, uint16_t *mv)
+{
+	int ret = adc_sample(cid);
+
+	if (ret == 0) {
+		*raw = adc_sample_buffer[0];
+		adc_convert_block(cid, adc_sample_buffer, 1, mv, 1);
+	}
+	return ret;
+}
+
+/* Converts all channels in the mask with one sequence */
+int adc_scan(uint32_t mask)
+{
+	int ret;
+
+	const struct adc_sequence sequence = {
+		.options = &adc_scan_options,
+		.channels = mask,
+		.buffer = adc_scan_buffer,
+		.buffer_size = sizeof(adc_scan_buffer),
+		.resolution = ADC_RESOLUTION,
+	};
+
+	if (adc_dev == NULL) {
+            printk("adc_scan(): error, must bind to adc first \n\r");
+            return -1;
+	}
+
+	ret = adc_read(adc_dev, &sequence);
+	if (ret) {
+            printk("adc_read() failed with code %d\n", ret);
+	}
+
+	return ret;
+}
+
+/* Filters, converts and publishes n raw samples of a channel taken dt us apart from t0;
+ * the last output, if any, also goes to the snapshot. Returns the number of samples published. */
+static size_t adc_publish(int ch, const uint16_t *raw, size_t stride, size_t n, uint32_t t0, uint32_t dt,
+			  struct adc_value_container *snapshot)
+{
+	static uint16_t filtered[MAX(MAX(ADC_STREAM_BLOCK, ADC_HR_BLOCK), ADC_OVERSAMPLE)];
+	static uint16_t converted[MAX(MAX(ADC_STREAM_BLOCK, ADC_HR_BLOCK), ADC_OVERSAMPLE)];
+	const int dec = dsp_decimation(ch);
+	const int first = dec - 1 - dsp_pending(ch); /* input that completes the first output */
+	size_t m;
+
+	m = dsp_process(ch, raw, stride, filtered, n);
+	adc_convert_block(ch, filtered, 1, converted, m);
+	for (size_t j = 0; j < m; j++) {
+		rtdb_ring_push(ch, t0 + (first + j * dec) * dt, filtered[j], converted[j]);
+	}
+	if (m > 0) {
+		snapshot->original_values[ch] = filtered[m - 1];
+		snapshot->converted_values[ch] = converted[m - 1];
+		snapshot->channel_timestamps[ch] = t0 + (first + (m - 1) * dec) * dt;
+	}
+	return m;
+}
+
 int adc_collect()
 {
-    int err = 0;
+    int err;
+    int k = 0; /* Index in the scan buffer, results are packed in channel order */
+    struct adc_plan *plan = &adc_plan[atomic_get(&adc_plan_sel)];
+    uint32_t mask;
+
+    /* Channels due on this tick; a committed plan starts at its first tick, where all are due */
+    mask = plan->mask[plan->tick];
+    plan->tick = (plan->tick + 1) % plan->len;
+    if (mask == 0) {
+        return 0;
+    }
+    const int width = __builtin_popcount(mask);
+
+    err = adc_scan(mask);
+    if(err) {
+        printk("adc_scan() for mask 0x%x failed with errocode %d\n\r", mask, err);
+        return err;
+    }
+    struct adc_value_container snapshot;
+
+    /* Channels whose filter produces no output this cycle keep their previous value */
+    rtdb_adc_read(&snapshot);
+    snapshot.timestamp = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
     for(int i = 0; i < NUM_CHANNELS; i++) {
-		err=adc_sample(i);
-		if(err) {
-			printk("adc_sample() for adc %d failed with errocode %d\n\r",i,err);
-            return err;
-		}
-        else {
-            adc_channel_values.original_values[i] = adc_sample_buffer[0];
-            adc_channel_values.converted_values[i] = (uint16_t)(1000 * adc_sample_buffer[0] * ((float)3 / 1023));
+        if(!(mask & BIT(i))) {
+            continue;
         }
-/*        else {
-            ADC_DB[i].actual_value = adc_sample_buffer[0];
-            ADC_DB[i].converted_value = (uint16_t)(1000 * adc_sample_buffer[0] * ((float)3 / 1023));
-        }*/
+        /* The ADC_OVERSAMPLE scans are back to back, they share the timestamp */
+        adc_publish(i, &adc_scan_buffer[k], width, ADC_OVERSAMPLE, snapshot.timestamp, 0, &snapshot);
+        k++;
 	}
+    rtdb_adc_write(&snapshot);
     return err;
 }
 
+/* Called by the ADC driver after each scan of a block; only stamps the start of the block */
+static enum adc_action adc_stream_cb(const struct device *dev, const struct adc_sequence *sequence, uint16_t sampling_index)
+{
+	if (sampling_index == 0) {
+		*(uint32_t *)sequence->options->user_data = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+	}
+	return ADC_ACTION_CONTINUE;
+}
+
+int adc_stream_start(void)
+{
+	int ret;
+
+	k_poll_signal_init(&adc_stream_signal);
+	k_poll_event_init(&adc_stream_event, K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &adc_stream_signal);
+	adc_stream_idx = 0;
+
+	ret = adc_read_async(adc_dev, &adc_stream_sequence[adc_stream_idx], &adc_stream_signal);
+	if (ret) {
+		printk("adc_read_async() failed with code %d\n", ret);
+	}
+	return ret;
+}
+
+int adc_stream_next(void)
+{
+	unsigned int signaled;
+	int result;
+	int done;
+	int ret;
+
+	/* Wait for the block being filled */
+	k_poll(&adc_stream_event, 1, K_FOREVER);
+	k_poll_signal_check(&adc_stream_signal, &signaled, &result);
+	k_poll_signal_reset(&adc_stream_signal);
+	adc_stream_event.state = K_POLL_STATE_NOT_READY;
+
+	/* Restart on the other buffer right away, so the acquisition gap is only the restart time */
+	done = adc_stream_idx;
+	adc_stream_idx ^= 1;
+	ret = adc_read_async(adc_dev, &adc_stream_sequence[adc_stream_idx], &adc_stream_signal);
+	if (ret) {
+		printk("adc_read_async() failed with code %d\n", ret);
+	}
+
+	if (result) {
+		printk("adc stream block failed with code %d\n", result);
+		return result;
+	}
+
+	/* Publish the completed block; scans are ADC_STREAM_INTERVAL_US apart */
+	struct adc_value_container snapshot;
+	const int width = __builtin_popcount(ADC_SCAN_MASK);
+	int k = 0;
+
+	rtdb_adc_read(&snapshot);
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		if (!(ADC_SCAN_MASK & BIT(i))) {
+			continue;
+		}
+		adc_publish(i, &adc_stream_buffer[done][0][k], width, ADC_STREAM_BLOCK,
+			    adc_stream_time[done], ADC_STREAM_INTERVAL_US, &snapshot);
+		k++;
+	}
+	snapshot.timestamp = adc_stream_time[done] + (ADC_STREAM_BLOCK - 1) * ADC_STREAM_INTERVAL_US;
+	rtdb_adc_write(&snapshot);
+	return ret;
+}
+
 void adc_print()
 {
+    struct adc_value_container snapshot;
+
+    rtdb_adc_read(&snapshot);
     for(int i = 0; i < NUM_CHANNELS; i++) {
-		if(adc_sample_buffer[0] > 1023) {
-			printk("adc %d reading out of rang(value is %u)\n\r",i,adc_channel_values.original_values[i]);
+		if(snapshot.original_values[i] > 1023) {
+			dlog_push(DLOG_ADC_RANGE, i, snapshot.original_values[i], 0);
 		}
 		else {
 			/* ADC is set to use gain of 1/and reference VDD/4, so inpurange is 0...VDD (3 V), with 1bit resolution */
-			printk("adc %d reading: %4u mV: \n\r",i,adc_channel_values.converted_values[i]);
+			dlog_push(DLOG_ADC_READING, i, snapshot.converted_values[i], 0);
 			}
     }
-}
\ No newline at end of file
+}
+
+int adc_hr_set_period(uint32_t period_us)
+{
+	if (period_us != 0 && (period_us < ADC_HR_MIN_US || period_us > ADC_HR_MAX_US)) {
+		return -EINVAL;
+	}
+#if ADC_HR_COUNTER
+	/* The counter runs at the period in its own ticks, the same us at a whole number of MHz */
+	if (period_us != 0) {
+		period_us = counter_ticks_to_us(adc_hr_counter, counter_us_to_ticks(adc_hr_counter, period_us));
+	}
+	adc_hr_period_us = period_us;
+	k_sem_give(&adc_hr_tick); /* let a running loop see the change */
+#else
+	/* The driver's k_timer runs at the period rounded up to the tick: use that period. Rounded down
+	 * to the us it still converts back to the same number of ticks. */
+	if (period_us != 0) {
+		period_us = k_ticks_to_us_floor32(k_us_to_ticks_ceil32(period_us));
+	}
+	adc_hr_period_us = period_us; /* a running block sees it at its next scan */
+#endif
+	return period_us;
+}
+
+uint32_t adc_hr_period(void)
+{
+	return adc_hr_period_us;
+}
+
+uint32_t adc_hr_missed(void)
+{
+	return atomic_get(&adc_hr_missed_count);
+}
+
+/* Publishes the first n scans of block buffer b, taken dt us apart from t0 */
+static void adc_hr_publish(int b, int n, uint32_t t0, uint32_t dt)
+{
+	const int width = __builtin_popcount(ADC_SCAN_MASK);
+	struct adc_value_container snapshot;
+	int k = 0;
+
+	rtdb_adc_read(&snapshot);
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		if (!(ADC_SCAN_MASK & BIT(i))) {
+			continue;
+		}
+		adc_publish(i, &adc_hr_buffer[b][0][k], width, n, t0, dt, &snapshot);
+		k++;
+	}
+	snapshot.timestamp = t0 + (n - 1) * dt;
+	rtdb_adc_write(&snapshot);
+}
+
+#if ADC_HR_PPI
+#define ADC_HR_SAADC_RESOLUTION (ADC_RESOLUTION == 8 ? NRF_SAADC_RESOLUTION_8BIT : \
+				 ADC_RESOLUTION == 12 ? NRF_SAADC_RESOLUTION_12BIT : \
+				 ADC_RESOLUTION == 14 ? NRF_SAADC_RESOLUTION_14BIT : NRF_SAADC_RESOLUTION_10BIT)
+
+/* Counter top callback (ISR): the TIMER has just triggered a scan over PPI. The first scan of a
+ * block stamps it and hands the previous block over, converted by now as a scan is shorter than
+ * the period. */
+static void adc_hr_counter_cb(const struct device *dev, void *user_data)
+{
+	const uint32_t n = (uint32_t)atomic_inc(&adc_hr_scans); /* index of this scan */
+
+	if (n % ADC_HR_BLOCK == 0) {
+		adc_hr_time[(n / ADC_HR_BLOCK) & 1] = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+		if (n > 0) {
+			k_sem_give(&adc_hr_tick);
+		}
+	}
+}
+
+/* Blocks whose last scan has been converted */
+static uint32_t adc_hr_blocks_done(void)
+{
+	const uint32_t n = atomic_get(&adc_hr_scans);
+
+	return (n > 0) ? (n - 1) / ADC_HR_BLOCK : 0;
+}
+
+/* Sets up the PPI channels once: every compare of the TIMER (its top value) samples the scan,
+ * every end of a block starts the next one on the buffer pointer set in the meantime */
+static int adc_hr_ppi_init(void)
+{
+	NRF_TIMER_Type *const timer = (NRF_TIMER_Type *)DT_REG_ADDR(ADC_HR_COUNTER_NODE);
+
+	if (adc_hr_ppi_ready) {
+		return 0;
+	}
+	if (nrfx_gppi_channel_alloc(&adc_hr_ppi[0]) != NRFX_SUCCESS) {
+		return -ENOMEM;
+	}
+	if (nrfx_gppi_channel_alloc(&adc_hr_ppi[1]) != NRFX_SUCCESS) {
+		nrfx_gppi_channel_free(adc_hr_ppi[0]);
+		return -ENOMEM;
+	}
+	nrfx_gppi_channel_endpoints_setup(adc_hr_ppi[0],
+					  nrf_timer_event_address_get(timer, NRF_TIMER_EVENT_COMPARE0),
+					  nrf_saadc_task_address_get(NRF_SAADC, NRF_SAADC_TASK_SAMPLE));
+	nrfx_gppi_channel_endpoints_setup(adc_hr_ppi[1],
+					  nrf_saadc_event_address_get(NRF_SAADC, NRF_SAADC_EVENT_END),
+					  nrf_saadc_task_address_get(NRF_SAADC, NRF_SAADC_TASK_START));
+	adc_hr_ppi_ready = true;
+	return 0;
+}
+
+int adc_hr_run(void)
+{
+	const uint32_t period = adc_hr_period_us;
+	const int width = __builtin_popcount(ADC_SCAN_MASK);
+	const uint32_t inten = nrf_saadc_int_enable_check(NRF_SAADC, NRF_SAADC_INT_ALL);
+	const struct counter_top_cfg top = {
+		.ticks = counter_us_to_ticks(adc_hr_counter, period),
+		.callback = adc_hr_counter_cb,
+	};
+	uint32_t served = 0; /* blocks published */
+	uint32_t ppi_mask;
+	int ret;
+
+	if (!device_is_ready(adc_hr_counter)) {
+		printk("adc_hr_run(): counter %s not ready\n\r", adc_hr_counter->name);
+		adc_hr_period_us = 0;
+		return -ENODEV;
+	}
+	ret = adc_hr_ppi_init();
+	if (ret) {
+		printk("adc_hr_run(): no PPI channel\n\r");
+		adc_hr_period_us = 0;
+		return ret;
+	}
+	ppi_mask = BIT(adc_hr_ppi[0]) | BIT(adc_hr_ppi[1]);
+
+	/* Take the SAADC over from its driver for the run: the inputs of the scan, and no interrupt,
+	 * whose handler would take the block ends for the end of a driver read */
+	nrf_saadc_int_disable(NRF_SAADC, NRF_SAADC_INT_ALL);
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		if (ADC_SCAN_MASK & BIT(i)) {
+			nrf_saadc_channel_pos_input_set(NRF_SAADC, i, (nrf_saadc_input_t)channel_cfg[i].input_positive);
+		}
+	}
+	nrf_saadc_resolution_set(NRF_SAADC, ADC_HR_SAADC_RESOLUTION);
+	nrf_saadc_oversample_set(NRF_SAADC, NRF_SAADC_OVERSAMPLE_DISABLED);
+	nrf_saadc_enable(NRF_SAADC);
+	nrf_saadc_event_clear(NRF_SAADC, NRF_SAADC_EVENT_STARTED);
+	nrf_saadc_event_clear(NRF_SAADC, NRF_SAADC_EVENT_END);
+	nrf_saadc_event_clear(NRF_SAADC, NRF_SAADC_EVENT_STOPPED);
+
+	/* Block 0 on buffer 0; the pointer of block 1 is latched by the START at the end of block 0 */
+	nrf_saadc_buffer_init(NRF_SAADC, (nrf_saadc_value_t *)adc_hr_buffer[0], ADC_HR_BLOCK * width);
+	nrf_saadc_task_trigger(NRF_SAADC, NRF_SAADC_TASK_START);
+	while (!nrf_saadc_event_check(NRF_SAADC, NRF_SAADC_EVENT_STARTED)) {
+	}
+	nrf_saadc_buffer_pointer_set(NRF_SAADC, (nrf_saadc_value_t *)adc_hr_buffer[1]);
+
+	atomic_set(&adc_hr_scans, 0);
+	k_sem_reset(&adc_hr_tick);
+	nrfx_gppi_channels_enable(ppi_mask);
+	ret = counter_set_top_value(adc_hr_counter, &top);
+	if (ret == 0) {
+		ret = counter_start(adc_hr_counter);
+	}
+	if (ret) {
+		printk("adc_hr_run(): counter start failed with code %d\n\r", ret);
+	}
+
+	while (ret == 0 && adc_hr_period_us == period) {
+		const int b = served & 1;
+		uint32_t done;
+
+		/* One wakeup per block */
+		k_sem_take(&adc_hr_tick, K_FOREVER);
+		done = adc_hr_blocks_done();
+		if (done == served) {
+			continue; /* woken up by adc_hr_set_period() */
+		}
+		/* The SAADC fills block served + 1 on the other buffer; this one is next, for block
+		 * served + 2, and its pointer must be set before block served + 1 ends */
+		nrf_saadc_event_clear(NRF_SAADC, NRF_SAADC_EVENT_END);
+		nrf_saadc_buffer_pointer_set(NRF_SAADC, (nrf_saadc_value_t *)adc_hr_buffer[b]);
+		if (done != served + 1 || nrf_saadc_event_check(NRF_SAADC, NRF_SAADC_EVENT_END) ||
+		    adc_hr_blocks_done() != done) {
+			/* Too late: blocks overwritten or a buffer reused, drop what was not published
+			 * and let the analog thread start over */
+			atomic_add(&adc_hr_missed_count, atomic_get(&adc_hr_scans) - served * ADC_HR_BLOCK);
+			break;
+		}
+		adc_hr_publish(b, ADC_HR_BLOCK, adc_hr_time[b], period);
+		served++;
+	}
+
+	/* Give the SAADC back to its driver; the block being filled is dropped */
+	counter_stop(adc_hr_counter);
+	nrfx_gppi_channels_disable(ppi_mask);
+	nrf_saadc_task_trigger(NRF_SAADC, NRF_SAADC_TASK_STOP);
+	while (!nrf_saadc_event_check(NRF_SAADC, NRF_SAADC_EVENT_STOPPED)) {
+	}
+	nrf_saadc_event_clear(NRF_SAADC, NRF_SAADC_EVENT_STOPPED);
+	nrf_saadc_event_clear(NRF_SAADC, NRF_SAADC_EVENT_STARTED);
+	nrf_saadc_event_clear(NRF_SAADC, NRF_SAADC_EVENT_END);
+	nrf_saadc_disable(NRF_SAADC);
+	nrf_saadc_int_enable(NRF_SAADC, inten);
+	if (ret) {
+		adc_hr_period_us = 0;
+	}
+	return ret;
+}
+#elif ADC_HR_COUNTER
+/* Counter alarm callback (ISR): re-arms the alarm one period later on the counter's own grid and
+ * hands the scan over to the analog thread */
+static void adc_hr_counter_cb(const struct device *dev, uint8_t chan_id, uint32_t ticks, void *user_data)
+{
+	adc_hr_alarm.ticks = (uint32_t)(((uint64_t)adc_hr_alarm.ticks + adc_hr_alarm_ticks) % ((uint64_t)adc_hr_counter_top + 1));
+	if (counter_set_channel_alarm(dev, chan_id, &adc_hr_alarm) != 0) {
+		/* Already past: the next scan is one period from now, off the grid */
+		const struct counter_alarm_cfg late = {.callback = adc_hr_counter_cb, .ticks = adc_hr_alarm_ticks};
+
+		counter_set_channel_alarm(dev, chan_id, &late);
+		adc_hr_alarm.ticks = (uint32_t)(((uint64_t)ticks + adc_hr_alarm_ticks) % ((uint64_t)adc_hr_counter_top + 1));
+	}
+	atomic_inc(&adc_hr_scans);
+	k_sem_give(&adc_hr_tick);
+}
+
+int adc_hr_run(void)
+{
+	const uint32_t period = adc_hr_period_us;
+	uint32_t start_us = 0;
+	uint32_t ticks;
+	uint32_t done = 0; /* scans handled */
+	uint32_t t0 = 0;
+	int slot = 0;
+	int ret;
+
+	if (!device_is_ready(adc_hr_counter)) {
+		printk("adc_hr_run(): counter %s not ready\n\r", adc_hr_counter->name);
+		adc_hr_period_us = 0;
+		return -ENODEV;
+	}
+	adc_hr_alarm_ticks = counter_us_to_ticks(adc_hr_counter, period);
+	adc_hr_counter_top = counter_get_top_value(adc_hr_counter);
+	atomic_set(&adc_hr_scans, 0);
+	k_sem_reset(&adc_hr_tick);
+	ret = counter_start(adc_hr_counter);
+	if (ret == 0) {
+		ret = counter_get_value(adc_hr_counter, &ticks);
+	}
+	if (ret == 0) {
+		/* Scan n (from 1) is due n periods after start_us */
+		start_us = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+		adc_hr_alarm = (struct counter_alarm_cfg){
+			.callback = adc_hr_counter_cb,
+			.ticks = (uint32_t)(((uint64_t)ticks + adc_hr_alarm_ticks) % ((uint64_t)adc_hr_counter_top + 1)),
+			.flags = COUNTER_ALARM_CFG_ABSOLUTE,
+		};
+		ret = counter_set_channel_alarm(adc_hr_counter, 0, &adc_hr_alarm);
+	}
+	if (ret) {
+		printk("adc_hr_run(): counter start failed with code %d\n\r", ret);
+	}
+
+	while (ret == 0 && adc_hr_period_us == period) {
+		uint32_t scans;
+
+		k_sem_take(&adc_hr_tick, K_FOREVER);
+		scans = atomic_get(&adc_hr_scans);
+		if (scans == done) {
+			continue; /* woken up by adc_hr_set_period() */
+		}
+		/* Scans beyond the one being served arrived while the previous scan was running: a block
+		 * only holds scans one period apart, so the one in progress is published as it is */
+		if (scans - done > 1) {
+			atomic_add(&adc_hr_missed_count, scans - done - 1);
+			if (slot > 0) {
+				adc_hr_publish(0, slot, t0, period);
+				slot = 0;
+			}
+		}
+		done = scans;
+
+		if (slot == 0) {
+			t0 = start_us + scans * period;
+		}
+		const struct adc_sequence sequence = {
+			.channels = ADC_SCAN_MASK,
+			.buffer = adc_hr_buffer[0][slot],
+			.buffer_size = sizeof(adc_hr_buffer[0][slot]),
+			.resolution = ADC_RESOLUTION,
+		};
+		ret = adc_read(adc_dev, &sequence);
+		if (ret) {
+			printk("adc_read() failed with code %d\n", ret);
+			break;
+		}
+		if (++slot == ADC_HR_BLOCK) {
+			adc_hr_publish(0, slot, t0, period);
+			slot = 0;
+		}
+	}
+
+	counter_cancel_channel_alarm(adc_hr_counter, 0);
+	counter_stop(adc_hr_counter);
+	if (ret) {
+		adc_hr_period_us = 0;
+		return ret;
+	}
+	if (slot > 0) {
+		adc_hr_publish(0, slot, t0, period);
+	}
+	return 0;
+}
+#else
+/* Called by the ADC driver (ISR) after each scan of a block: stamps the block, counts the scans
+ * that ended after the next one was due, and ends the block early if the mode was left */
+static enum adc_action adc_hr_cb(const struct device *dev, const struct adc_sequence *sequence, uint16_t sampling_index)
+{
+	const int b = (int)(uintptr_t)sequence->options->user_data;
+	const uint32_t period = sequence->options->interval_us; /* the timer period, whole ticks */
+	const uint32_t now = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+
+	if (sampling_index == 0) {
+		adc_hr_time[b] = now;
+	}
+	else if (now - adc_hr_time[b] >= (sampling_index + 1) * period) {
+		atomic_inc(&adc_hr_missed_count);
+	}
+	adc_hr_time_last[b] = now;
+	adc_hr_count[b] = sampling_index + 1;
+	return (adc_hr_period_us == period) ? ADC_ACTION_CONTINUE : ADC_ACTION_FINISH;
+}
+
+/* Starts the acquisition of block b */
+static int adc_hr_start(int b)
+{
+	int ret;
+
+	adc_hr_count[b] = 0;
+	ret = adc_read_async(adc_dev, &adc_hr_sequence[b], &adc_hr_signal);
+	if (ret) {
+		printk("adc_read_async() failed with code %d\n", ret);
+	}
+	return ret;
+}
+
+int adc_hr_run(void)
+{
+	const uint32_t period = adc_hr_period_us;
+	int idx = 0;
+	int ret;
+
+	for (int b = 0; b < 2; b++) {
+		adc_hr_options[b] = (struct adc_sequence_options){
+			.interval_us = period,
+			.callback = adc_hr_cb,
+			.user_data = (void *)(uintptr_t)b,
+			.extra_samplings = ADC_HR_BLOCK - 1,
+		};
+		adc_hr_sequence[b] = (struct adc_sequence){
+			.options = &adc_hr_options[b],
+			.channels = ADC_SCAN_MASK,
+			.buffer = adc_hr_buffer[b],
+			.buffer_size = sizeof(adc_hr_buffer[b]),
+			.resolution = ADC_RESOLUTION,
+		};
+	}
+	k_poll_signal_init(&adc_hr_signal);
+	k_poll_event_init(&adc_hr_event, K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &adc_hr_signal);
+	ret = adc_hr_start(idx);
+
+	while (ret == 0) {
+		unsigned int signaled;
+		int result;
+		int done;
+		bool more;
+
+		/* One wakeup per block */
+		k_poll(&adc_hr_event, 1, K_FOREVER);
+		k_poll_signal_check(&adc_hr_signal, &signaled, &result);
+		k_poll_signal_reset(&adc_hr_signal);
+		adc_hr_event.state = K_POLL_STATE_NOT_READY;
+
+		/* Restart on the other buffer right away, unless the mode was left */
+		done = idx;
+		idx ^= 1;
+		more = (adc_hr_period_us == period);
+		if (more) {
+			ret = adc_hr_start(idx);
+		}
+
+		/* -EBUSY: some scans started late, already counted by the callback; the samples are valid */
+		if (result != 0 && result != -EBUSY) {
+			printk("adc high-rate block failed with code %d\n", result);
+		}
+		else if (adc_hr_count[done] > 0) {
+			/* Scans are one timer period apart, a whole number of ticks that adc_hr_period_us
+			 * holds rounded down to the us: take the exact spacing from the stamps of the block */
+			const int n = adc_hr_count[done];
+			const uint32_t dt = (n > 1) ? (adc_hr_time_last[done] - adc_hr_time[done]) / (n - 1) : period;
+
+			adc_hr_publish(done, n, adc_hr_time[done], dt);
+		}
+		if (!more) {
+			return 0;
+		}
+	}
+	adc_hr_period_us = 0;
+	return ret;
+}
+#endif
@@ -16,7 +16,16 @@
 #include <zephyr/devicetree.h>	    /* for DT_NODELABEL() */
 #include <zephyr/drivers/gpio.h>    /* for GPIO API*/
 #include <zephyr/drivers/adc.h>     /* for ADC API*/
+#ifdef CONFIG_ADC_NRFX_SAADC
 #include <hal/nrf_saadc.h>
+#endif
+#if defined(CONFIG_ADC_CONFIGURABLE_INPUTS) && defined(CONFIG_ADC_NRFX_SAADC)
+#define ADC_INPUT(n) .input_positive = NRF_SAADC_INPUT_AIN##n /**< SAADC analog input of a channel */
+#elif defined(CONFIG_ADC_CONFIGURABLE_INPUTS)
+#define ADC_INPUT(n) .input_positive = n /**< Other ADCs with configurable inputs: input n */
+#else
+#define ADC_INPUT(n) /**< Fixed inputs (e.g. the ADC emulator): channel n converts input n */
+#endif
 /*******************************/
 /*ADC definitions and includes*/
 #define ADC_RESOLUTION 10
@@ -25,19 +34,54 @@
 #define ADC_REFERENCE ADC_REF_VDD_1_4
 #define ADC_ACQUISITION_TIME ADC_ACQ_TIME(ADC_ACQ_TIME_MICROSECONDS, 40)
 
-#define MEM_SIZE 10 /**< Number of Data Elements to be saved */
+/* Conversion to mV, derived at compile time from the ADC configuration above */
+#define ADC_VDD_MV 3000 /**< Supply voltage of the board (in mV) */
+#define ADC_MAX_CODE ((1U << ADC_RESOLUTION) - 1) /**< Highest code, read at full scale */
+#define ADC_GAIN_NUM(g) ((g) == ADC_GAIN_2 ? 2 : (g) == ADC_GAIN_4 ? 4 : 1) /**< Numerator of a gain */
+#define ADC_GAIN_DEN(g) ((g) == ADC_GAIN_1_6 ? 6 : (g) == ADC_GAIN_1_5 ? 5 : (g) == ADC_GAIN_1_4 ? 4 : \
+			 (g) == ADC_GAIN_1_3 ? 3 : (g) == ADC_GAIN_1_2 ? 2 : 1) /**< Denominator of a gain */
+#define ADC_REF_MV(r) ((r) == ADC_REF_VDD_1_4 ? ADC_VDD_MV / 4 : (r) == ADC_REF_VDD_1 ? ADC_VDD_MV : 600) /**< Reference voltage (in mV) */
+#define ADC_FULL_SCALE_MV (ADC_REF_MV(ADC_REFERENCE) * ADC_GAIN_DEN(ADC_GAIN) / ADC_GAIN_NUM(ADC_GAIN)) /**< Input at ADC_MAX_CODE (in mV) */
+
+/* mV = (code * ADC_MV_MULT) >> ADC_MV_SHIFT equals floor(ADC_FULL_SCALE_MV * code / ADC_MAX_CODE) for every code:
+ * the rounding error of the multiplier is below 1/ADC_MAX_CODE, so it never reaches the next integer. */
+#define ADC_MV_SHIFT (2 * ADC_RESOLUTION) /**< Fraction bits of the conversion multiplier */
+#define ADC_MV_MULT ((((uint64_t)ADC_FULL_SCALE_MV << ADC_MV_SHIFT) + ADC_MAX_CODE - 1) / ADC_MAX_CODE) /**< Conversion multiplier */
+
+#define ADC_CAL_GAIN_ONE (1 << 14) /**< Per-channel gain of 1.0 (Q14) */
+
+#define MEM_SIZE 64 /**< Number of Data Elements to be saved (depth of each channel's sample ring) */
 
 #define BUFFER_SIZE 1
 
+#define ADC_SCAN_MASK ((1U << NUM_CHANNELS) - 1) /**< Channels converted by one scan sequence */
+#define ADC_OVERSAMPLE 1 /**< Back-to-back scans per periodic collect, all passed through the filter stage */
+
+/* Per-channel sampling periods */
+#define ADC_PLAN_MAX 64 /**< Longest sampling plan (in analog ticks): the hyperperiod over the tick */
+
+/* Streaming acquisition */
+#define ADC_STREAMING 0 /**< 1: continuous double-buffered acquisition, 0: one scan per analog thread period */
+#define ADC_STREAM_BLOCK 32 /**< Number of scans in each streamed block */
+#define ADC_STREAM_INTERVAL_US 1000 /**< Interval between two scans of a block (in us) */
+
+/* High-rate acquisition, paced by the counter under the devicetree alias adc-hr-counter when the board
+ * has one (at the period in us), otherwise by the ADC driver's kernel timer (in whole ticks) */
+#define ADC_HR_COUNTER_NODE DT_ALIAS(adc_hr_counter) /**< Counter that paces the high-rate scans */
+#define ADC_HR_COUNTER DT_NODE_HAS_STATUS(ADC_HR_COUNTER_NODE, okay) /**< 1: paced by ADC_HR_COUNTER_NODE, 0: by the kernel timer */
+#define ADC_HR_BLOCK 32 /**< Number of scans in each block, published together */
+#define ADC_HR_MIN_US 200 /**< Shortest period (in us), above the conversion time of all channels */
+#define ADC_HR_MAX_US 999999 /**< Longest period (in us) */
+
 //extern struct adc_channel_values; // for rtdb
 //extern struct adc_channel_values ADC_DB[4]; // for rtdb
 
 /* ADC channels configuration */
 static const struct adc_channel_cfg channel_cfg[NUM_CHANNELS] = {
-        {.gain = ADC_GAIN, .reference = ADC_REFERENCE, .acquisition_time = ADC_ACQUISITION_TIME, .channel_id = 0, .input_positive = NRF_SAADC_INPUT_AIN0},
-        {.gain = ADC_GAIN, .reference = ADC_REFERENCE, .acquisition_time = ADC_ACQUISITION_TIME, .channel_id = 1, .input_positive = NRF_SAADC_INPUT_AIN1},
-        {.gain = ADC_GAIN, .reference = ADC_REFERENCE, .acquisition_time = ADC_ACQUISITION_TIME, .channel_id = 2, .input_positive = NRF_SAADC_INPUT_AIN2},
-        {.gain = ADC_GAIN, .reference = ADC_REFERENCE, .acquisition_time = ADC_ACQUISITION_TIME, .channel_id = 3, .input_positive = NRF_SAADC_INPUT_AIN3},
+        {.gain = ADC_GAIN, .reference = ADC_REFERENCE, .acquisition_time = ADC_ACQUISITION_TIME, .channel_id = 0, ADC_INPUT(0)},
+        {.gain = ADC_GAIN, .reference = ADC_REFERENCE, .acquisition_time = ADC_ACQUISITION_TIME, .channel_id = 1, ADC_INPUT(1)},
+        {.gain = ADC_GAIN, .reference = ADC_REFERENCE, .acquisition_time = ADC_ACQUISITION_TIME, .channel_id = 2, ADC_INPUT(2)},
+        {.gain = ADC_GAIN, .reference = ADC_REFERENCE, .acquisition_time = ADC_ACQUISITION_TIME, .channel_id = 3, ADC_INPUT(3)},
 };
 
 static uint16_t adc_sample_buffer[BUFFER_SIZE];
@@ -60,17 +104,170 @@ void adc_init(void);
  */
 int adc_sample(int cid);
 
+/** \brief ADC sample mV
+ * 
+ * This function takes one sample of a channel and converts it with the channel's calibration.
+ * The filter stage is not applied.
+ * 
+ * \param cid Channel ID for which the sample is to be taken
+ * \param raw Destination of the raw value
+ * \param mv Destination of the value in mV
+ * \return 0 on success, negative error code on failure
+ */
+int adc_sample_mv(int cid, uint16_t *raw, uint16_t *mv);
+
+/** \brief ADC scan
+ * 
+ * This function converts every channel in the mask ADC_OVERSAMPLE times, back to back, with a single
+ * adc_read() call. Results are stored in adc_scan_buffer scan after scan, each in ascending channel order.
+ * 
+ * \param mask Bit mask of the channels to convert
+ * \return 0 on success, negative error code on failure
+ */
+int adc_scan(uint32_t mask);
+
+/** \brief ADC set channel period
+ * 
+ * Sets the sampling period of a channel and rebuilds the sampling plan: the analog tick is the
+ * greatest common divisor of the periods and, for each tick of the hyperperiod (their least common
+ * multiple), the plan holds the mask of the channels due, converted by one scan sequence.
+ * A channel with period 0 is converted on every tick. The channel periods assume the analog task
+ * runs at the returned tick; changing the analog period scales them.
+ * 
+ * \param cid Channel ID
+ * \param period_ms Sampling period (in ms), 0 for every tick
+ * \return the analog tick (in ms), 0 if every channel is converted on every tick,
+ * -EINVAL for an invalid channel or a hyperperiod longer than ADC_PLAN_MAX ticks
+ */
+int adc_set_channel_period(int cid, uint32_t period_ms);
+
+/** \brief ADC prepare channel period
+ * 
+ * Builds the sampling plan adc_set_channel_period() would apply, in the idle copy, without
+ * applying it, so the returned tick can go through admission control first. The next
+ * adc_commit_channel_period() applies it; another prepare replaces it.
+ * 
+ * \param cid Channel ID
+ * \param period_ms Sampling period (in ms), 0 for every tick
+ * \return as adc_set_channel_period()
+ */
+int adc_prepare_channel_period(int cid, uint32_t period_ms);
+
+/** \brief ADC commit channel period
+ * 
+ * Applies the plan built by the last successful adc_prepare_channel_period(), in one store.
+ * The next adc_collect() runs its first tick, where every channel is due
+ * 
+ */
+void adc_commit_channel_period(void);
+
+/** \brief ADC channel period
+ * 
+ * \param cid Channel ID
+ * \return the sampling period of the channel (in ms), 0 for every tick
+ */
+uint32_t adc_channel_period(int cid);
+
+/** \brief ADC set calibration
+ * 
+ * Sets the gain and offset applied to a channel on top of the nominal conversion.
+ * 
+ * \param cid Channel ID
+ * \param gain Gain in Q14 (ADC_CAL_GAIN_ONE is 1.0)
+ * \param offset_mv Offset added after the gain (in mV)
+ * \return 0 on success, -EINVAL for an invalid channel
+ */
+int adc_set_calibration(int cid, uint16_t gain, int16_t offset_mv);
+
+/** \brief ADC convert block
+ * 
+ * Converts n raw samples of one channel to mV with the channel's calibration.
+ * With the default calibration the result equals 1000 * code * 3 / 1023, truncated.
+ * 
+ * \param cid Channel ID, selects the calibration
+ * \param raw First raw sample
+ * \param stride Distance between two raw samples (1 for a contiguous block, the scan width for interleaved blocks)
+ * \param mv Output, n contiguous values in mV
+ * \param n Number of samples
+ */
+void adc_convert_block(int cid, const uint16_t *raw, size_t stride, uint16_t *mv, size_t n);
+
 /** \brief ADC collect
  * 
  * Collects the readings from the ADC during each cycle and saves them to the RTDB.
- * 
+ * The channels of ADC_SCAN_MASK due on this tick of the sampling plan (all of them unless channel
+ * periods are set) are converted in one scan sequence and filtered by the channel's filter.
  * 
  */
 int adc_collect();
 
+/** \brief ADC stream start
+ * 
+ * Starts the continuous acquisition into the first of the two block buffers.
+ * The ADC paces the scans by itself, using ADC_STREAM_INTERVAL_US.
+ * 
+ * \return 0 on success, negative error code on failure
+ */
+int adc_stream_start(void);
+
+/** \brief ADC stream next
+ * 
+ * Waits until the current block is complete, starts the acquisition of the
+ * other buffer and publishes the completed block to the RTDB sample rings.
+ * 
+ * \return 0 on success, negative error code on failure
+ */
+int adc_stream_next(void);
+
+/** \brief ADC high-rate set period
+ * 
+ * Selects the high-rate mode period. The analog thread switches to the high-rate mode at its
+ * next job when the period is not 0, and back to the periodic mode when it is 0; a running
+ * block ends at its next scan. Paced by the counter (ADC_HR_COUNTER), the period is kept to
+ * the us (the counter runs at a whole number of MHz). Paced by the ADC driver's kernel timer,
+ * it is rounded up to a whole number of kernel ticks (e.g. 200 us is 7 ticks, 213 us, on the
+ * 32768 Hz nRF tick).
+ * 
+ * \param period_us Period (in us), ADC_HR_MIN_US..ADC_HR_MAX_US, or 0 to leave the high-rate mode
+ * \return period in use (in us, rounded to the counter or kernel tick), 0 when the mode was left,
+ * -EINVAL if the period is out of range
+ */
+int adc_hr_set_period(uint32_t period_us);
+
+/** \brief ADC high-rate period
+ * 
+ * \return period of the high-rate mode (in us), 0 when not selected
+ */
+uint32_t adc_hr_period(void);
+
+/** \brief ADC high-rate run
+ * 
+ * Runs the high-rate mode until its period is changed, publishing each block of ADC_HR_BLOCK
+ * scans to the RTDB from two alternating buffers.
+ * On the nRF SAADC with the counter, the TIMER triggers every scan over PPI and EasyDMA fills
+ * the blocks; the counter callback only hands the full ones over, so this loop wakes up once
+ * per block. A block not handed back in time ends the run early with its scans counted as
+ * missed, and the analog thread starts it again.
+ * With the counter on other ADCs (the emulated counter of native_sim), the counter callback
+ * releases each scan of this loop.
+ * Without the counter, each block is one asynchronous read with extra samplings, paced by the
+ * ADC driver's timer; its callback only stamps the scans and this loop wakes up once per block.
+ * 
+ * \return 0 when the mode was left or a block was overrun, negative error code if the
+ * acquisition could not be started
+ */
+int adc_hr_run(void);
+
+/** \brief ADC high-rate missed
+ * 
+ * \return number of scans that ended after the next one was due, or that were dropped because
+ * their block was not handed back in time
+ */
+uint32_t adc_hr_missed(void);
+
 /** \brief ADC print
  * 
- * Prints results of ADC readings
+ * Prints results of ADC readings, through the deferred log
  * 
  * 
  */
@@ -0,0 +1,759 @@
+/**
+ * \file GMTcmd.c
+ * 
+ * \brief Command reception and processing code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>      /* for printk()*/
+#include <string.h>
+#include "GMTcmd.h"
+#include "GMTdsp.h"
+#include "GMTadc.h"
+#include "rtdb.h"
+#include "GMThist.h"
+#include "GMTrec.h"
+#include "GMTtelem.h"
+#include "GMTctrl.h"
+#include "GMTpwm.h"
+#include "GMTwave.h"
+#include "GMTlog.h"
+#ifdef CONFIG_THREAD_ANALYZER
+#include <zephyr/debug/thread_analyzer.h>
+#endif
+
+#define EXIT_SUCCESS    0;      /**< SUCCESSFUL EXIT */
+#define EMPTY_STRING   -1;      /**< EMPTY STRING */
+#define CMD_NOT_FOUND  -2;      /**< INVALID CMD */
+#define WRONG_STR_FORMAT -3;    /**< WRONG FORMAT */
+#define PERIOD_REJECTED -4;     /**< PERIOD OUT OF RANGE OR NOT SCHEDULABLE */
+#define CMD_BUSY -5;            /**< PREVIOUS BATCH NOT APPLIED YET */
+
+K_MSGQ_DEFINE(cmd_msgq, sizeof(struct cmd_frame), CMD_QUEUE_LEN, 1);
+
+/* Parser state, only used from the UART callback */
+static struct cmd_frame rxFrame;    /**< Frame being received */
+static bool inFrame;                /**< SOF_SYM seen, EOF_SYM not yet */
+static uint32_t dropped;
+
+static char report[PTASK_REPORT_SIZE]; /**< Statistics frame, sized for every task */
+
+void cmd_rx(const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = buf[i];
+
+        if (c == SOF_SYM) {
+            /* A new start of frame always resynchronises, dropping any unfinished frame */
+            rxFrame.len = 0;
+            inFrame = true;
+        }
+        else if (!inFrame) {
+            /* Bytes outside of a frame (line endings, noise) are ignored */
+        }
+        else if (c == EOF_SYM) {
+            if (k_msgq_put(&cmd_msgq, &rxFrame, K_NO_WAIT) != 0) {
+                dropped++;
+            }
+            inFrame = false;
+        }
+        else if (rxFrame.len < CMD_MAX_LEN) {
+            rxFrame.str[rxFrame.len++] = c;
+        }
+        else {
+            /* Too long: discard and wait for the next SOF_SYM */
+            dropped++;
+            inFrame = false;
+        }
+    }
+}
+
+int cmd_get(struct cmd_frame *frame, k_timeout_t timeout)
+{
+    return k_msgq_get(&cmd_msgq, frame, timeout);
+}
+
+uint32_t cmd_dropped(void)
+{
+    return dropped;
+}
+
+#define CMD_DIGITS_MAX 9 /**< Longest number cmd_digits() parses: 999999999 fits in an int */
+
+/* Parses n decimal digits; returns -1 if any of them is not a digit or there are too many.
+ * Callers check the length of their field first, this is only the last line of defence. */
+static int cmd_digits(const char *str, int n)
+{
+    int value = 0;
+
+    if (n > CMD_DIGITS_MAX) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (str[i] < '0' || str[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + (str[i] - '0');
+    }
+    return value;
+}
+
+/* Parses one hexadecimal digit; returns -1 if it is not one */
+static int cmd_hex(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c &= ~0x20;     /* upper case */
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static atomic_t cmdAnPeriod;  /**< Analog period last set by $TI or TI=, used when no channel has its own period */
+
+/* Requests a new period; reports it as $A,name,period& when it was clamped */
+static int cmdPeriod(struct ptask *t, int period_ms)
+{
+    int admitted = ptask_admit(t, period_ms);
+
+    if (admitted < 0) {
+        return PERIOD_REJECTED;
+    }
+    if (t == &task_an) {
+        atomic_set(&cmdAnPeriod, admitted);
+    }
+    if (admitted != period_ms) {
+        printk("$A,%s,%d&\n\r", t->name, admitted);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Setting of a batch frame: $KEY=value,KEY=value,...& */
+struct cmd_setting {
+    const char *key;            /* Two upper case letters */
+    int min;
+    int max;
+    struct ptask *task;         /* Period of this task, admitted with the other periods of the batch */
+    void (*apply)(int value);   /* Otherwise, applied by cmd_commit() */
+};
+
+static void cmd_set_setpoint(int value)
+{
+    ctrl_set_setpoint(value);
+}
+
+static void cmd_set_kp(int value)
+{
+    ctrl_set_gain(CTRL_P, value);
+}
+
+static void cmd_set_ki(int value)
+{
+    ctrl_set_gain(CTRL_I, value);
+}
+
+static void cmd_set_kd(int value)
+{
+    ctrl_set_gain(CTRL_D, value);
+}
+
+static const struct cmd_setting cmd_settings[] = {
+    {"TI", 1, PTASK_PERIOD_MAX, &task_an, NULL},
+    {"TO", 1, PTASK_PERIOD_MAX, &task_pwm, NULL},
+    {"CS", 0, ADC_FULL_SCALE_MV, NULL, cmd_set_setpoint},
+    {"CP", 0, 9999, NULL, cmd_set_kp},
+    {"CI", 0, 9999, NULL, cmd_set_ki},
+    {"CD", 0, 9999, NULL, cmd_set_kd},
+};
+
+/* Validated settings waiting for the next cycle */
+struct cmd_batch {
+    const struct cmd_setting *setting[CMD_BATCH_MAX];
+    int value[CMD_BATCH_MAX];
+    int n;
+};
+
+enum {
+    CMD_BATCH_IDLE,
+    CMD_BATCH_STAGED,           /* Written by the command thread, waiting for cmd_commit() */
+    CMD_BATCH_APPLYING,         /* Owned by cmd_commit() */
+};
+
+static struct cmd_batch batch;
+static atomic_t batchState = ATOMIC_INIT(CMD_BATCH_IDLE);
+
+static const struct cmd_setting *cmd_setting_find(char c0, char c1)
+{
+    c0 &= ~0x20;    /* upper case */
+    c1 &= ~0x20;
+    for (int i = 0; i < ARRAY_SIZE(cmd_settings); i++) {
+        if (cmd_settings[i].key[0] == c0 && cmd_settings[i].key[1] == c1) {
+            return &cmd_settings[i];
+        }
+    }
+    return NULL;
+}
+
+/* Periods of a batch, in the form ptask_admissible_n() takes them; returns their number */
+static int cmd_batch_periods(const struct cmd_batch *b, struct ptask **tasks, int *periods)
+{
+    int n = 0;
+
+    for (int k = 0; k < b->n; k++) {
+        if (b->setting[k]->task != NULL) {
+            tasks[n] = b->setting[k]->task;
+            periods[n++] = b->value[k];
+        }
+    }
+    return n;
+}
+
+/* Validates every setting of the frame, periods jointly, and stages them for cmd_commit() */
+static int cmdBatch(const struct cmd_frame *frame)
+{
+    struct ptask *tasks[CMD_BATCH_MAX];
+    int periods[CMD_BATCH_MAX];
+    struct cmd_batch b = {0};
+    int i = 0, n, value;
+
+    /* i == frame->len after a trailing comma: the empty last setting is parsed and rejected */
+    while (i <= frame->len) {
+        const char *tok = &frame->str[i];
+        const struct cmd_setting *s;
+        int len = 0;
+
+        while (i + len < frame->len && tok[len] != ',') {
+            len++;
+        }
+        i += len + 1;
+        /* KEY=value, one to five digits */
+        if (len < 4 || len > 8 || tok[2] != '=' || b.n == CMD_BATCH_MAX) {
+            return WRONG_STR_FORMAT;
+        }
+        s = cmd_setting_find(tok[0], tok[1]);
+        value = cmd_digits(&tok[3], len - 3);
+        if (s == NULL || value < s->min || value > s->max) {
+            return CMD_NOT_FOUND;
+        }
+        for (int k = 0; k < b.n; k++) {
+            if (b.setting[k] == s) {
+                return WRONG_STR_FORMAT;
+            }
+        }
+        b.setting[b.n] = s;
+        b.value[b.n++] = value;
+    }
+    n = cmd_batch_periods(&b, tasks, periods);
+    if (n > 0 && ptask_admissible_n(tasks, periods, n) != 0) {
+        return PERIOD_REJECTED;
+    }
+
+    /* Stage; the next analog or PWM job applies it and reports $B,result& */
+    if (atomic_get(&batchState) != CMD_BATCH_IDLE) {
+        return CMD_BUSY;
+    }
+    batch = b;
+    atomic_set(&batchState, CMD_BATCH_STAGED);
+    return EXIT_SUCCESS;
+}
+
+void cmd_commit(void)
+{
+    struct ptask *tasks[CMD_BATCH_MAX];
+    int periods[CMD_BATCH_MAX];
+    int n, result;
+
+    if (!atomic_cas(&batchState, CMD_BATCH_STAGED, CMD_BATCH_APPLYING)) {
+        return;
+    }
+    /* No other thread runs until every setting is applied */
+    k_sched_lock();
+    n = cmd_batch_periods(&batch, tasks, periods);
+    /* A single command may have changed a period since the batch was validated */
+    result = (n > 0) ? ptask_admissible_n(tasks, periods, n) : 0;
+    if (result == 0) {
+        ptask_set_periods(tasks, periods, n);
+        for (int k = 0; k < n; k++) {
+            if (tasks[k] == &task_an) {
+                atomic_set(&cmdAnPeriod, periods[k]);   /* as $TI: restored when the plan is cleared */
+            }
+        }
+        for (int k = 0; k < batch.n; k++) {
+            if (batch.setting[k]->apply != NULL) {
+                batch.setting[k]->apply(batch.value[k]);
+            }
+        }
+    }
+    k_sched_unlock();
+    atomic_set(&batchState, CMD_BATCH_IDLE);
+    /* Formatted by the drain thread, not in the job */
+    dlog_push(DLOG_CMD_BATCH, (uint32_t)result, 0, 0);
+}
+
+/* periods: $TI/$TO<ms>& for the analog and PWM threads, $TC<channel><ms>&, $TH<us>& */
+static int cmdTiming(const struct cmd_frame *frame)
+{
+    int value;
+
+    if (frame->len < 2) {
+        return WRONG_STR_FORMAT;
+    }
+    /* change the sampling period of one channel; the analog period follows the plan's tick */
+    if (frame->str[1] == 'C' || frame->str[1] == 'c') {
+        int ch, tick, period;
+
+        if (frame->len != 7) {
+            return CMD_NOT_FOUND;
+        }
+        ch = cmd_digits(&frame->str[2], 1);
+        value = cmd_digits(&frame->str[3], 4);
+        if (ch < 0 || value < 0) {
+            return CMD_NOT_FOUND;
+        }
+        /* Plan and analog period are checked before anything is applied */
+        tick = adc_prepare_channel_period(ch, value);
+        if (tick < 0) {
+            return CMD_NOT_FOUND;
+        }
+        /* no plan yet: the period set by $TI */
+        atomic_cas(&cmdAnPeriod, 0, task_an.period);
+        /* Every channel on every tick: back to the period set by $TI */
+        period = (tick > 0) ? tick : atomic_get(&cmdAnPeriod);
+        /* The tick cannot be clamped without changing every channel's period */
+        if (ptask_admissible(&task_an, period) != period) {
+            return PERIOD_REJECTED;
+        }
+        adc_commit_channel_period();
+        ptask_admit(&task_an, period);
+        return EXIT_SUCCESS;
+    }
+    /* change period of the high-rate analog input mode (in us, up to six digits) */
+    if (frame->str[1] == 'H' || frame->str[1] == 'h') {
+        if (frame->len - 2 < 1 || frame->len - 2 > 6) {
+            return CMD_NOT_FOUND;
+        }
+        value = cmd_digits(&frame->str[2], frame->len - 2);
+        if (value < 0) {
+            return CMD_NOT_FOUND;
+        }
+        int used = adc_hr_set_period(value);
+
+        if (used < 0) {
+            return CMD_NOT_FOUND;
+        }
+        /* Rounded to the pacing tick (whole kernel ticks without the counter): report the period used */
+        if (used != value) {
+            printk("$A,hr,%d&\n\r", used);
+        }
+        return EXIT_SUCCESS;
+    }
+    if (frame->len - 2 != 4) {
+        return CMD_NOT_FOUND;
+    }
+    value = cmd_digits(&frame->str[2], 4);
+    if (value < 0) {
+        return CMD_NOT_FOUND;
+    }
+    /* change period of PWM thread, subject to admission control */
+    if (frame->str[1] == 'O' || frame->str[1] == 'o') {
+        return cmdPeriod(&task_pwm, value);
+    }
+    /* change period of analog input thread, subject to admission control */
+    else if (frame->str[1] == 'I' || frame->str[1] == 'i') {
+        return cmdPeriod(&task_an, value);
+    }
+    return CMD_NOT_FOUND;
+}
+
+/* select the filter of a channel: $F<channel><N|B|I|M><param>& */
+static int cmdFilter(const struct cmd_frame *frame)
+{
+    static const char types[] = "NBIM";
+    const char *type;
+    int value;
+
+    if (frame->len < 3 || frame->len > 5) {
+        return WRONG_STR_FORMAT;
+    }
+    type = strchr(types, frame->str[2] & ~0x20);   /* upper case */
+    value = cmd_digits(&frame->str[3], frame->len - 3);
+    if (frame->str[1] < '0' || frame->str[1] > '9' || type == NULL || value < 0) {
+        return CMD_NOT_FOUND;
+    }
+    if (dsp_set(frame->str[1] - '0', (enum dsp_filter)(type - types), value) != 0) {
+        return CMD_NOT_FOUND;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Length of a control frame: one channel digit for E, four digits for S, P, I and D, none for
+ * X and L; -1 for an unknown command */
+static int cmd_control_len(char c)
+{
+    switch (c & ~0x20) {   /* upper case */
+    case 'E':
+        return 3;
+    case 'S':
+    case 'P':
+    case 'I':
+    case 'D':
+        return 6;
+    case 'X':
+    case 'L':
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+/* closed-loop control: $CE<channel>&, $CX&, $CS<mV>&, $CP/$CI/$CD<gain>&, $CL& */
+static int cmdControl(const struct cmd_frame *frame)
+{
+    struct ctrl_latency lat;
+    int value;
+
+    if (frame->len < 2) {
+        return WRONG_STR_FORMAT;
+    }
+    if (frame->len != cmd_control_len(frame->str[1])) {
+        return CMD_NOT_FOUND;
+    }
+    value = cmd_digits(&frame->str[2], frame->len - 2);
+    if (value < 0) {
+        return CMD_NOT_FOUND;
+    }
+    switch (frame->str[1] & ~0x20) {   /* upper case */
+    case 'E':
+        if (ctrl_enable(value) != 0) {
+            return CMD_NOT_FOUND;
+        }
+        return EXIT_SUCCESS;
+    case 'X':
+        ctrl_disable();
+        return EXIT_SUCCESS;
+    case 'S': {
+        /* Same range as the batch setting CS= */
+        const struct cmd_setting *cs = cmd_setting_find('C', 'S');
+
+        if (value < cs->min || value > cs->max) {
+            return CMD_NOT_FOUND;
+        }
+        ctrl_set_setpoint(value);
+        return EXIT_SUCCESS;
+    }
+    case 'P':
+        ctrl_set_gain(CTRL_P, value);
+        return EXIT_SUCCESS;
+    case 'I':
+        ctrl_set_gain(CTRL_I, value);
+        return EXIT_SUCCESS;
+    case 'D':
+        ctrl_set_gain(CTRL_D, value);
+        return EXIT_SUCCESS;
+    case 'L':
+        ctrl_get_latency(&lat);
+        printk("$L,%u,%u,%u&\n\r", lat.last, lat.max, lat.count);
+        return EXIT_SUCCESS;
+    default:
+        return CMD_NOT_FOUND;
+    }
+}
+
+/* map a PWM bank output to an analog input: $PM<output><channel>&, $PM<output>X& to unmap */
+static int cmdPwm(const struct cmd_frame *frame)
+{
+    int ch;
+
+    if (frame->len != 4 || (frame->str[1] & ~0x20) != 'M' || frame->str[2] < '0' || frame->str[2] > '9') {
+        return CMD_NOT_FOUND;
+    }
+    if ((frame->str[3] & ~0x20) == 'X') {
+        ch = PWM_UNMAPPED;
+    }
+    else if (frame->str[3] >= '0' && frame->str[3] <= '9') {
+        ch = frame->str[3] - '0';
+    }
+    else {
+        return CMD_NOT_FOUND;
+    }
+    if (pwm_bank_map(frame->str[2] - '0', ch) != 0) {
+        return CMD_NOT_FOUND;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* waveform playback: $WS<len>&, $WR<len>&, $WP<index><vvvv>...&, $WN<len>&, $WG<step us>&, $WX& */
+static int cmdWave(const struct cmd_frame *frame)
+{
+    uint16_t values[(CMD_MAX_LEN - 5) / 4];
+    int idx, n, ret, value;
+
+    if (frame->len < 2) {
+        return WRONG_STR_FORMAT;
+    }
+    switch (frame->str[1] & ~0x20) {   /* upper case */
+    case 'P':
+        if (frame->len < 9 || (frame->len - 5) % 4 != 0) {
+            return CMD_NOT_FOUND;
+        }
+        n = (frame->len - 5) / 4;
+        idx = cmd_digits(&frame->str[2], 3);
+        if (idx < 0) {
+            return CMD_NOT_FOUND;
+        }
+        for (int i = 0; i < n; i++) {
+            value = cmd_digits(&frame->str[5 + 4 * i], 4);
+            if (value < 0) {
+                return CMD_NOT_FOUND;
+            }
+            values[i] = value;
+        }
+        if (wave_set(idx, values, n) != 0) {
+            return CMD_NOT_FOUND;
+        }
+        return EXIT_SUCCESS;
+    case 'X':
+        if (frame->len != 2) {
+            return CMD_NOT_FOUND;
+        }
+        wave_stop();
+        return EXIT_SUCCESS;
+    default:
+        break;
+    }
+    if (frame->len - 2 < 1 || frame->len - 2 > 6) {
+        return CMD_NOT_FOUND;
+    }
+    value = cmd_digits(&frame->str[2], frame->len - 2);
+    if (value < 0) {
+        return CMD_NOT_FOUND;
+    }
+    switch (frame->str[1] & ~0x20) {
+    case 'S':
+        ret = wave_load_sine(value);
+        break;
+    case 'R':
+        ret = wave_load_ramp(value);
+        break;
+    case 'N':
+        ret = wave_set_length(value);
+        break;
+    case 'G':
+        ret = wave_start(value);
+        break;
+    default:
+        return CMD_NOT_FOUND;
+    }
+    if (ret != 0) {
+        return CMD_NOT_FOUND;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* channel statistics: $Q<channel>& queries, $QS<channel><len>& / $QT<channel><len>& select the window */
+static int cmdQuery(const struct cmd_frame *frame)
+{
+    struct adc_stats stats;
+    int ch, ret, value;
+
+    if (frame->len == 2) {
+        ch = cmd_digits(&frame->str[1], 1);
+        if (ch < 0 || rtdb_stats_get(ch, &stats) != 0) {
+            return CMD_NOT_FOUND;
+        }
+        printk("$Q,%d,%u,%u,%u,%u,%u,%u,%u&\n\r", ch, stats.count, stats.min, stats.max,
+               stats.mean, stats.variance, stats.rms, stats.timestamp);
+        return EXIT_SUCCESS;
+    }
+    if (frame->len < 4 || frame->len > 7) {
+        return CMD_NOT_FOUND;
+    }
+    ch = cmd_digits(&frame->str[2], 1);
+    value = cmd_digits(&frame->str[3], frame->len - 3);
+    if (ch < 0 || value < 0) {
+        return CMD_NOT_FOUND;
+    }
+    switch (frame->str[1] & ~0x20) {   /* upper case */
+    case 'S':
+        ret = rtdb_stats_set_window(ch, RTDB_WINDOW_SLIDING, value);
+        break;
+    case 'T':
+        ret = rtdb_stats_set_window(ch, RTDB_WINDOW_TUMBLING, value);
+        break;
+    default:
+        return CMD_NOT_FOUND;
+    }
+    if (ret != 0) {
+        return CMD_NOT_FOUND;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* history: $HL<mask><n>& last n samples and $HQ<channel><seq>& samples since seq, as binary
+ * history frames; $HS& compressed history figures, after decoding every block once to time the decoder */
+static int cmdHistory(const struct cmd_frame *frame)
+{
+    static struct adc_ts_sample samples[HIST_BLOCK_MAX_SAMPLES];
+    struct hist_stats stats;
+    int mask, value;
+
+    if (frame->len < 2) {
+        return WRONG_STR_FORMAT;
+    }
+    switch (frame->str[1] & ~0x20) {   /* upper case */
+    case 'L':
+        if (frame->len < 4 || frame->len > 6) {
+            return CMD_NOT_FOUND;
+        }
+        mask = cmd_hex(frame->str[2]);
+        value = cmd_digits(&frame->str[3], frame->len - 3);
+        if (value < 0 || mask <= 0) {
+            return CMD_NOT_FOUND;
+        }
+        for (int ch = 0; ch < NUM_CHANNELS; ch++) {
+            if ((mask & BIT(ch)) && telem_history(ch, 0, value) < 0) {
+                return CMD_NOT_FOUND;
+            }
+        }
+        return EXIT_SUCCESS;
+    case 'Q':
+        if (frame->len < 4 || frame->len > 12) {
+            return CMD_NOT_FOUND;
+        }
+        mask = cmd_digits(&frame->str[2], 1);
+        value = cmd_digits(&frame->str[3], frame->len - 3);
+        if (mask < 0 || value < 0) {
+            return CMD_NOT_FOUND;
+        }
+        if (telem_history(mask, value, MEM_SIZE) < 0) {
+            return CMD_NOT_FOUND;
+        }
+        return EXIT_SUCCESS;
+    case 'S':
+        if (frame->len != 2) {
+            return CMD_NOT_FOUND;
+        }
+        break;
+    default:
+        return CMD_NOT_FOUND;
+    }
+    printk("$H");
+    for (int ch = 0; ch < NUM_CHANNELS; ch++) {
+        for (int age = 0; age < hist_blocks(ch); age++) {
+            hist_read(ch, age, samples, HIST_BLOCK_MAX_SAMPLES);
+        }
+        hist_get_stats(ch, &stats);
+        printk(";%d,%u,%u,%u,%u,%u,%u", ch, stats.samples, stats.bytes,
+               stats.encoded, stats.encode_ns, stats.decoded, stats.decode_ns);
+    }
+    printk("&\n\r");
+    return EXIT_SUCCESS;
+}
+
+/* flash recorder: $RS& figures, $RD& dump, $RF& flush, $RE& erase */
+static int cmdRecorder(const struct cmd_frame *frame)
+{
+    struct rec_stats stats;
+    int ret;
+
+    if (frame->len != 2) {
+        return CMD_NOT_FOUND;
+    }
+    switch (frame->str[1] & ~0x20) {   /* upper case */
+    case 'S':
+        if (!REC_ENABLE) {
+            return CMD_NOT_FOUND;
+        }
+        rec_get_stats(&stats);
+        printk("$RS,%u,%u,%u,%u,%u,%u,%u,%u,%u&\n\r", stats.records, stats.dropped, stats.chunks,
+               stats.payload_bytes, stats.flash_bytes, stats.erases, stats.erase_bytes, stats.write_us,
+               stats.an_missed);
+        return EXIT_SUCCESS;
+    case 'D':
+        ret = rec_dump();
+        break;
+    case 'F':
+        ret = rec_flush();
+        break;
+    case 'E':
+        ret = rec_erase();
+        break;
+    default:
+        return CMD_NOT_FOUND;
+    }
+    if (ret < 0) {
+        return CMD_NOT_FOUND;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* print the stack high-water mark of every thread */
+static int cmdStack(const struct cmd_frame *frame)
+{
+    if (frame->len != 1) {
+        return CMD_NOT_FOUND;
+    }
+#ifdef CONFIG_THREAD_ANALYZER
+    thread_analyzer_print();
+    return EXIT_SUCCESS;
+#else
+    return CMD_NOT_FOUND;
+#endif
+}
+
+/* dump the execution statistics of every task */
+static int cmdReport(const struct cmd_frame *frame)
+{
+    if (frame->len != 1) {
+        return CMD_NOT_FOUND;
+    }
+    ptask_report(report, sizeof(report));
+    printk("%s\n\r", report);
+    return EXIT_SUCCESS;
+}
+
+/* Handlers of the single commands, indexed by their upper case first letter */
+static int (*const cmdHandlers[26])(const struct cmd_frame *frame) = {
+    ['C' - 'A'] = cmdControl,
+    ['F' - 'A'] = cmdFilter,
+    ['H' - 'A'] = cmdHistory,
+    ['K' - 'A'] = cmdStack,
+    ['P' - 'A'] = cmdPwm,
+    ['Q' - 'A'] = cmdQuery,
+    ['R' - 'A'] = cmdRecorder,
+    ['S' - 'A'] = cmdReport,
+    ['T' - 'A'] = cmdTiming,
+    ['W' - 'A'] = cmdWave,
+};
+
+int cmdProcess(const struct cmd_frame *frame)
+{
+    int (*handler)(const struct cmd_frame *frame);
+    char c;
+
+    /* Detect empty cmd string */
+    if (frame->len == 0) {
+        return EMPTY_STRING;
+    }
+    /* The parser already delivers the body of a "$...&" frame: a batch of settings or one command */
+    if (memchr(frame->str, '=', frame->len) != NULL) {
+        return cmdBatch(frame);
+    }
+    c = frame->str[0] & ~0x20;  /* upper case */
+    if (c < 'A' || c > 'Z') {
+        return CMD_NOT_FOUND;
+    }
+    handler = cmdHandlers[c - 'A'];
+    if (handler == NULL) {
+        return CMD_NOT_FOUND;
+    }
+    return handler(frame);
+}
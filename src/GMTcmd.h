@@ -0,0 +1,137 @@
+/**
+ * \file GMTcmd.h
+ * 
+ * \brief Command reception and processing header
+ * 
+ * Commands have the format $TXYYYY& (or $tXYYYY&), where X is O/o for the PWM thread
+ * or I/i for the analog input thread and YYYY are four digits of the period (in ms).
+ * A period that fails the schedulability test is raised to the shortest feasible one, reported as
+ * $A,name,period&, or rejected (see ptask_admit()).
+ * $TCNYYYY& sets the sampling period of analog channel N to YYYY ms (0000: every analog tick);
+ * the analog thread period becomes the greatest common divisor of the channel periods and each
+ * tick converts the channels due with one scan (see adc_set_channel_period()). The new plan is only
+ * applied if its tick passes the schedulability test; when no channel has its own period any more,
+ * the analog thread goes back to the period last set by $TIYYYY&.
+ * $THYYYYYY& selects the high-rate analog input mode with a period of one to six digits in us
+ * (ADC_HR_MIN_US and up). Paced by the counter (ADC_HR_COUNTER, timer2 on the DK) the period is
+ * used as given; paced by the ADC driver's kernel timer it is rounded up to a whole number of kernel
+ * ticks and, when that changes it, the one used is reported as $A,hr,period& (e.g. $TH200& gives
+ * $A,hr,213& on the 32768 Hz nRF tick). $TH0& goes back to the periodic mode.
+ * $CEN& enters closed-loop control with channel N as process variable, $CX& leaves it,
+ * $CSYYYY& sets the setpoint (in mV, up to ADC_FULL_SCALE_MV), $CPYYYY&, $CIYYYY& and $CDYYYY& set the PID gains (Q8)
+ * and $CL& prints the sample to actuation latency as $L,last,max,count& (in us); in the streaming and
+ * high-rate modes the loop runs on the newest published sample, so the latency includes its block
+ * (see ctrl_step()).
+ * $PMOC& makes analog input C drive PWM bank output O, $PMOX& releases output O.
+ * $WSNNN& and $WRNNN& load a sine or a ramp of NNN entries into the waveform table,
+ * $WPIIIVVVV...& writes consecutive duty cycles VVVV (per mille) from entry III, $WNNNN& sets
+ * the number of entries played, $WGYYYYYY& starts the playback with YYYYYY us per entry and $WX& stops it.
+ * $QN& prints the statistics of channel N over its window as $Q,N,count,min,max,mean,variance,rms,timestamp&
+ * (in mV, mV^2 and us); $QSNLLLL& selects a sliding window of the last LLLL samples (up to MEM_SIZE),
+ * $QTNLLLL& a tumbling window of LLLL samples (see rtdb_stats_get()).
+ * $HLMN& queues binary history frames (see telem_history()) with the last N samples (one to three
+ * digits) of every channel in the hexadecimal mask M; $HQCS& queues the samples of channel C
+ * since ring sequence number S (up to nine digits). Acquisition is not stopped.
+ * $HS& prints the compressed history figures of every channel as
+ * $H;ch,samples,bytes,encoded,encode_ns,decoded,decode_ns;...& after decoding every block once
+ * (see hist_get_stats()); samples * sizeof(struct adc_ts_sample) / bytes is the gain over the rings.
+ * With the flash recorder (rec.conf): $RD& prints every recorded snapshot as $R,seq,timestamp,raw0,...&,
+ * $RF& writes the snapshots waiting in RAM, $RE& erases the record and $RS& prints
+ * $RS,records,dropped,chunks,payload_bytes,flash_bytes,erases,erase_bytes,write_us,an_missed&
+ * (write amplification is flash_bytes / payload_bytes, throughput payload_bytes / write_us).
+ * $S& dumps the execution statistics of every task (see ptask_report()).
+ * With the debug build (debug.conf): $K& prints the stack size and high-water mark of every thread
+ * (thread analyzer).
+ * $FCTP& selects the filter of channel C: T is N (none), B (boxcar), I (IIR) or M (median)
+ * and P its parameter, up to two digits (see dsp_set()); e.g. $F0B8&, $F2M5&, $F1N&.
+ * A frame with '=' is a batch of up to CMD_BATCH_MAX settings KEY=value separated by commas, e.g.
+ * $TI=0200,TO=0500,CS=1500&. Keys are TI and TO (periods in ms), CS (setpoint in mV) and CP, CI, CD
+ * (PID gains, Q8). Every setting is validated first, the periods with one schedulability test and
+ * without clamping, and the command returns once they are staged; all of them are applied together at
+ * the start of the next analog or PWM job (see cmd_commit()), which reports $B,0&, or $B,<error>& (see
+ * ptask_admissible_n()) when a period changed since and the batch is dropped. TI= is recorded as $TI
+ * is. A single invalid setting rejects the whole frame, as does an empty one (e.g. a trailing comma);
+ * a batch sent before the previous one is applied is rejected with -5.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTCMD_H_
+#define GMTCMD_H_
+
+#include <zephyr/kernel.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "GMTtask.h"
+
+#define SOF_SYM '$'             /**< START OF COMMAND SYMBOL */
+#define EOF_SYM '&'             /**< END OF COMMAND SYMBOL */
+#define CMD_MAX_LEN 64          /**< Maximum number of characters between SOF_SYM and EOF_SYM, up to 255 */
+#define CMD_QUEUE_LEN 4         /**< Number of complete frames that can wait for the command thread */
+#define CMD_BATCH_MAX 8         /**< Maximum number of settings in a batch frame */
+
+#if CMD_MAX_LEN > 255
+#error "CMD_MAX_LEN does not fit in struct cmd_frame"
+#endif
+
+/** Body of a complete frame, without SOF_SYM and EOF_SYM */
+struct cmd_frame {
+    char str[CMD_MAX_LEN];
+    uint8_t len;
+};
+
+/* Periodic tasks, defined in GMTjob.c, whose periods are changed by the commands */
+extern struct ptask task_an;
+extern struct ptask task_pwm;
+
+/** \brief Command receive
+ * 
+ * Feeds a chunk of received bytes to the frame parser. Each byte is handled in constant time;
+ * every complete frame is queued for the command thread. Called from the UART callback,
+ * directly on the driver's buffer.
+ * 
+ * \param buf First received byte
+ * \param len Number of received bytes
+ */
+void cmd_rx(const uint8_t *buf, size_t len);
+
+/** \brief Command get
+ * 
+ * Waits for the next complete frame
+ * 
+ * \param frame Destination of the frame
+ * \param timeout Maximum waiting time
+ * \return 0 on success, -EAGAIN on timeout
+ */
+int cmd_get(struct cmd_frame *frame, k_timeout_t timeout);
+
+/** \brief Command dropped
+ * 
+ * \return number of frames discarded because they were too long or the queue was full
+ */
+uint32_t cmd_dropped(void);
+
+/** \brief Function to Process a received frame
+ * 
+ * \param frame Frame to process
+ * \return  0: valid command                        	    
+ * \return	-1: empty string                   
+ * \return	-2: invalid command found                            
+ * \return	-3: incorrect string format found                       
+ * \return	-4: period out of range or not schedulable
+ * \return	-5: the previous batch is not applied yet
+ */
+int cmdProcess(const struct cmd_frame *frame);
+
+/** \brief Command commit
+ * 
+ * Applies the batch of settings staged by cmdProcess(), if any, with the scheduler locked so that
+ * no thread sees part of it, and pushes its result as a DLOG_CMD_BATCH record. Called at the start of
+ * the analog and PWM jobs, the cycle boundary.
+ */
+void cmd_commit(void);
+
+#endif /* GMTCMD_H_ */
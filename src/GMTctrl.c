@@ -0,0 +1,143 @@
+/**
+ * \file GMTctrl.c
+ * 
+ * \brief Closed-loop control code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/timing/timing.h>   /* for timing services */
+#include <zephyr/sys/atomic.h>
+#include "GMTctrl.h"
+#include "GMTadc.h"
+#include "GMTpwm.h"
+#include "rtdb.h"
+
+#define CTRL_NO_STAMP UINT32_MAX /**< The process variable was sampled by the step itself */
+
+/* Integral term limit, so it alone can at most drive the output to full scale (anti-windup) */
+#define CTRL_INTEG_MAX ((int32_t)CTRL_DUTY_MAX << CTRL_GAIN_SHIFT)
+
+static volatile int ctrl_channel = -1;     /**< Process variable channel, -1 when disabled */
+static volatile int32_t ctrl_setpoint;
+static volatile int32_t ctrl_gain[3];       /**< Gains, indexed by enum ctrl_term (Q8) */
+static int32_t ctrl_integ;                  /**< Sum of ki * error (Q8) */
+static int32_t ctrl_prev_pv;
+static bool ctrl_first;                     /**< No previous sample for the derivative yet */
+static uint32_t ctrl_prev_ts;               /**< Timestamp of the RTDB sample used last (asynchronous acquisition) */
+static atomic_t ctrl_reset;                 /**< Set by ctrl_enable(), the state is cleared by ctrl_step() */
+static struct ctrl_latency ctrl_lat;
+
+void ctrl_init(void)
+{
+    ctrl_channel = -1;
+    ctrl_setpoint = CTRL_SETPOINT_INIT;
+    ctrl_gain[CTRL_P] = CTRL_KP_INIT;
+    ctrl_gain[CTRL_I] = CTRL_KI_INIT;
+    ctrl_gain[CTRL_D] = CTRL_KD_INIT;
+    ctrl_lat = (struct ctrl_latency){0};
+}
+
+int ctrl_enable(int ch)
+{
+    if (ch < 0 || ch >= NUM_CHANNELS) {
+        return -EINVAL;
+    }
+    /* The PID state belongs to the PWM thread: it is cleared there, before the first step */
+    atomic_set(&ctrl_reset, 1);
+    ctrl_channel = ch;
+    return 0;
+}
+
+void ctrl_disable(void)
+{
+    ctrl_channel = -1;
+}
+
+bool ctrl_enabled(void)
+{
+    return ctrl_channel >= 0;
+}
+
+void ctrl_set_setpoint(int32_t mv)
+{
+    ctrl_setpoint = mv;
+}
+
+void ctrl_set_gain(enum ctrl_term term, int32_t gain)
+{
+    ctrl_gain[term] = gain;
+}
+
+int ctrl_step(void)
+{
+    const int ch = ctrl_channel;
+    timing_t t_sample, t_actuate;
+    uint32_t sample_us = CTRL_NO_STAMP; /* conversion time of an RTDB sample (in us) */
+    uint16_t raw, mv;
+    int32_t err, out;
+    int ret;
+
+    if (ch < 0) {
+        return -EINVAL;
+    }
+    if (atomic_clear(&ctrl_reset)) {
+        ctrl_integ = 0;
+        ctrl_first = true;
+    }
+
+    t_sample = timing_counter_get();
+    if (ADC_STREAMING || adc_hr_period() != 0) {
+        /* The ADC runs an asynchronous block and adc_sample() would wait for its end: take the
+         * newest published sample instead, and count the latency from its conversion */
+        struct adc_value_container snapshot;
+
+        rtdb_adc_read(&snapshot);
+        if (!ctrl_first && snapshot.channel_timestamps[ch] == ctrl_prev_ts) {
+            return 0;           /* no new sample since the last step */
+        }
+        ctrl_prev_ts = snapshot.channel_timestamps[ch];
+        mv = snapshot.converted_values[ch];
+        sample_us = ctrl_prev_ts;
+    }
+    else {
+        ret = adc_sample_mv(ch, &raw, &mv);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    /* PID in Q8; the derivative is taken on the measurement to avoid kicks on setpoint changes */
+    err = ctrl_setpoint - mv;
+    ctrl_integ = CLAMP(ctrl_integ + ctrl_gain[CTRL_I] * err, -CTRL_INTEG_MAX, CTRL_INTEG_MAX);
+    out = ctrl_gain[CTRL_P] * err + ctrl_integ;
+    if (!ctrl_first) {
+        out -= ctrl_gain[CTRL_D] * ((int32_t)mv - ctrl_prev_pv);
+    }
+    ctrl_prev_pv = mv;
+    ctrl_first = false;
+    out = CLAMP(out >> CTRL_GAIN_SHIFT, 0, CTRL_DUTY_MAX);
+
+    ret = pwm_set_duty(out);
+    t_actuate = timing_counter_get();
+
+    if (sample_us != CTRL_NO_STAMP) {
+        ctrl_lat.last = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks()) - sample_us;
+    }
+    else {
+        ctrl_lat.last = (uint32_t)(timing_cycles_to_ns(timing_cycles_get(&t_sample, &t_actuate)) / 1000);
+    }
+    ctrl_lat.max = MAX(ctrl_lat.max, ctrl_lat.last);
+    ctrl_lat.count++;
+    return ret;
+}
+
+void ctrl_get_latency(struct ctrl_latency *latency)
+{
+    *latency = ctrl_lat;
+}
@@ -0,0 +1,104 @@
+/**
+ * \file GMTctrl.h
+ * 
+ * \brief Closed-loop control header
+ * 
+ * In control mode the PWM job samples one ADC channel (the process variable), runs a
+ * fixed-point PID and applies the new duty cycle, all in the same job.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTCTRL_H_
+#define GMTCTRL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CTRL_GAIN_SHIFT 8 /**< Gains are in Q8: 256 is 1.0 (duty per mille per mV) */
+#define CTRL_KP_INIT 64 /**< Initial proportional gain (Q8) */
+#define CTRL_KI_INIT 16 /**< Initial integral gain, per job (Q8) */
+#define CTRL_KD_INIT 0 /**< Initial derivative gain, per job (Q8) */
+#define CTRL_SETPOINT_INIT 1500 /**< Initial setpoint (in mV) */
+#define CTRL_DUTY_MAX 1000 /**< Largest duty cycle (per mille) */
+
+/** Terms of the PID */
+enum ctrl_term {
+    CTRL_P,             /**< Proportional */
+    CTRL_I,             /**< Integral, per job */
+    CTRL_D,             /**< Derivative, per job */
+};
+
+/** Sample to actuation latency of the control jobs */
+struct ctrl_latency {
+    uint32_t last;      /**< Last job (in us) */
+    uint32_t max;       /**< Worst job (in us) */
+    uint32_t count;     /**< Number of control jobs */
+};
+
+/** \brief Control init
+ * 
+ * Sets the initial gains and setpoint; control mode starts disabled
+ * 
+ */
+void ctrl_init(void);
+
+/** \brief Control enable
+ * 
+ * Enters control mode with a channel as process variable; the PID state is cleared by the
+ * next ctrl_step(), in the PWM thread, before it computes anything
+ * 
+ * \param ch ADC channel
+ * \return 0 on success, -EINVAL for an invalid channel
+ */
+int ctrl_enable(int ch);
+
+/** \brief Control disable
+ * 
+ * Leaves control mode; the PWM job goes back to the period based duty cycle
+ * 
+ */
+void ctrl_disable(void);
+
+/** \brief Control enabled
+ * 
+ * \return true in control mode
+ */
+bool ctrl_enabled(void);
+
+/** \brief Control set setpoint
+ * 
+ * \param mv Setpoint (in mV)
+ */
+void ctrl_set_setpoint(int32_t mv);
+
+/** \brief Control set gain
+ * 
+ * \param term PID term
+ * \param gain Gain of the term (Q8)
+ */
+void ctrl_set_gain(enum ctrl_term term, int32_t gain);
+
+/** \brief Control step
+ * 
+ * One control job: samples the process variable, runs the PID and sets the duty cycle. While
+ * the ADC runs asynchronous blocks (streaming or high-rate mode) a single conversion would wait
+ * for the running block, up to ADC_STREAM_BLOCK or ADC_HR_BLOCK scans: the process variable is
+ * then the newest sample published to the RTDB, and the step does nothing until a newer one is
+ * published. The latency is then counted from the conversion of that sample, so it includes
+ * the wait for the end of its block.
+ * 
+ * \return 0 on success, negative error code on failure
+ */
+int ctrl_step(void);
+
+/** \brief Control latency
+ * 
+ * \param latency Destination of the sample to actuation latency counters
+ */
+void ctrl_get_latency(struct ctrl_latency *latency);
+
+#endif /* GMTCTRL_H_ */
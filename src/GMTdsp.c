@@ -0,0 +1,205 @@
+/**
+ * \file GMTdsp.c
+ * 
+ * \brief Per-channel filter stage code
+ * 
+ * The kernels are plain loops over whole blocks with integer arithmetic only, so the
+ * compiler can unroll and vectorise them where the target allows it.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <string.h>
+#include "GMTdsp.h"
+#include "GMTadc.h"
+
+struct dsp_channel {
+    enum dsp_filter type;
+    int param;
+    uint32_t box_sum;                       /**< Sum of the samples of the unfinished boxcar group */
+    int box_count;                          /**< Samples in the unfinished boxcar group */
+    int32_t iir;                            /**< IIR output (Q16) */
+    bool iir_valid;                         /**< IIR state holds a sample */
+    uint16_t hist[DSP_MEDIAN_MAX];          /**< Last samples, for the median */
+    int hist_len;
+    atomic_t request;                       /**< New filter requested by dsp_set(), applied by the writer */
+};
+
+static struct dsp_channel dsp_channels[NUM_CHANNELS];
+
+/* Packed request, non-zero even for DSP_NONE */
+#define DSP_REQUEST(type, param) (BIT(31) | ((type) << 16) | (param))
+
+int dsp_set(int ch, enum dsp_filter type, int param)
+{
+    if (ch < 0 || ch >= NUM_CHANNELS) {
+        return -EINVAL;
+    }
+    switch (type) {
+    case DSP_NONE:
+        param = 1;
+        break;
+    case DSP_BOXCAR:
+        if (param < 1 || param > DSP_BOXCAR_MAX) {
+            return -EINVAL;
+        }
+        break;
+    case DSP_IIR:
+        if (param < 1 || param > DSP_IIR_SHIFT_MAX) {
+            return -EINVAL;
+        }
+        break;
+    case DSP_MEDIAN:
+        if (param != 3 && param != 5) {
+            return -EINVAL;
+        }
+        break;
+    default:
+        return -EINVAL;
+    }
+    /* The state belongs to the acquisition context: it is cleared there, at the next block */
+    atomic_set(&dsp_channels[ch].request, DSP_REQUEST(type, param));
+    return 0;
+}
+
+int dsp_decimation(int ch)
+{
+    struct dsp_channel *c = &dsp_channels[ch];
+    atomic_val_t request = atomic_set(&c->request, 0);
+
+    /* New filter: restart from an empty state; request is left alone, dsp_set() may write it */
+    if (request) {
+        c->type = (enum dsp_filter)((request >> 16) & 0xff);
+        c->param = request & 0xffff;
+        c->box_sum = 0;
+        c->box_count = 0;
+        c->iir_valid = false;
+        c->hist_len = 0;
+    }
+    return c->type == DSP_BOXCAR ? c->param : 1;
+}
+
+int dsp_pending(int ch)
+{
+    return dsp_channels[ch].type == DSP_BOXCAR ? dsp_channels[ch].box_count : 0;
+}
+
+static size_t dsp_boxcar(struct dsp_channel *c, const uint16_t *in, size_t stride, uint16_t *out, size_t n)
+{
+    const int factor = c->param;
+    size_t i = 0;
+    size_t m = 0;
+
+    /* Complete the group left unfinished by the previous block */
+    if (c->box_count > 0) {
+        while (c->box_count < factor && i < n) {
+            c->box_sum += in[i++ * stride];
+            c->box_count++;
+        }
+        if (c->box_count < factor) {
+            return 0;
+        }
+        out[m++] = (uint16_t)((c->box_sum + factor / 2) / factor);
+    }
+    /* Whole groups: the inner loop has a fixed trip count and no dependency on the outputs */
+    for (; i + factor <= n; i += factor) {
+        uint32_t sum = 0;
+
+        for (int k = 0; k < factor; k++) {
+            sum += in[(i + k) * stride];
+        }
+        out[m++] = (uint16_t)((sum + factor / 2) / factor);
+    }
+    /* Keep the remainder for the next block */
+    c->box_sum = 0;
+    c->box_count = 0;
+    for (; i < n; i++) {
+        c->box_sum += in[i * stride];
+        c->box_count++;
+    }
+    return m;
+}
+
+static size_t dsp_iir(struct dsp_channel *c, const uint16_t *in, size_t stride, uint16_t *out, size_t n)
+{
+    int32_t y = c->iir;
+
+    if (!c->iir_valid && n > 0) {
+        y = (int32_t)in[0] << 16;           /* start from the first sample, not from 0 */
+        c->iir_valid = true;
+    }
+    for (size_t j = 0; j < n; j++) {
+        y += (((int32_t)in[j * stride] << 16) - y) >> c->param;
+        out[j] = (uint16_t)((y + (1 << 15)) >> 16);
+    }
+    c->iir = y;
+    return n;
+}
+
+#define DSP_SORT2(a, b) do { uint16_t lo = MIN(a, b); b = MAX(a, b); a = lo; } while (0)
+
+static uint16_t dsp_median3(uint16_t a, uint16_t b, uint16_t c)
+{
+    return MAX(MIN(a, b), MIN(MAX(a, b), c));
+}
+
+static uint16_t dsp_median5(const uint16_t *w)
+{
+    uint16_t a = w[0], b = w[1], c = w[2], d = w[3], e = w[4];
+
+    /* The median of five is the median of c and the two middle values of the other four */
+    DSP_SORT2(a, b);
+    DSP_SORT2(d, e);
+    DSP_SORT2(a, d);    /* a is the minimum of a, b, d, e */
+    DSP_SORT2(b, e);    /* e is the maximum of a, b, d, e */
+    return dsp_median3(b, c, d);
+}
+
+static size_t dsp_median(struct dsp_channel *c, const uint16_t *in, size_t stride, uint16_t *out, size_t n)
+{
+    const int w = c->param;
+
+    for (size_t j = 0; j < n; j++) {
+        /* Slide the window; until it is full the newest sample passes through unfiltered */
+        if (c->hist_len == w) {
+            memmove(&c->hist[0], &c->hist[1], (w - 1) * sizeof(c->hist[0]));
+            c->hist_len--;
+        }
+        c->hist[c->hist_len++] = in[j * stride];
+        if (c->hist_len < w) {
+            out[j] = c->hist[c->hist_len - 1];
+        }
+        else if (w == 3) {
+            out[j] = dsp_median3(c->hist[0], c->hist[1], c->hist[2]);
+        }
+        else {
+            out[j] = dsp_median5(c->hist);
+        }
+    }
+    return n;
+}
+
+size_t dsp_process(int ch, const uint16_t *in, size_t stride, uint16_t *out, size_t n)
+{
+    struct dsp_channel *c = &dsp_channels[ch];
+
+    switch (c->type) {
+    case DSP_BOXCAR:
+        return dsp_boxcar(c, in, stride, out, n);
+    case DSP_IIR:
+        return dsp_iir(c, in, stride, out, n);
+    case DSP_MEDIAN:
+        return dsp_median(c, in, stride, out, n);
+    default:
+        for (size_t j = 0; j < n; j++) {
+            out[j] = in[j * stride];
+        }
+        return n;
+    }
+}
@@ -0,0 +1,77 @@
+/**
+ * \file GMTdsp.h
+ * 
+ * \brief Per-channel filter stage header
+ * 
+ * Each channel has one filter, applied to blocks of raw samples between the acquisition
+ * and the RTDB. The filters work on raw codes, the conversion to mV happens after them.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTDSP_H_
+#define GMTDSP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DSP_BOXCAR_MAX 64 /**< Largest boxcar decimation factor */
+#define DSP_IIR_SHIFT_MAX 8 /**< Largest IIR shift (alpha = 2^-shift) */
+#define DSP_MEDIAN_MAX 5 /**< Largest median window (3 or 5) */
+
+/** Filter of a channel */
+enum dsp_filter {
+    DSP_NONE,       /**< Samples pass unchanged */
+    DSP_BOXCAR,     /**< Mean of each group of param samples; one output per group (decimation), groups may span blocks */
+    DSP_IIR,        /**< First-order low-pass y += (x - y) / 2^param, fixed-point Q16 */
+    DSP_MEDIAN,     /**< Median of the last param (3 or 5) samples, for glitch rejection; raw until the window fills */
+};
+
+/** \brief DSP set
+ * 
+ * Selects the filter of a channel. Only the request is stored here: the acquisition context
+ * applies it, and clears the filter state, at its next dsp_decimation() of the channel, so a
+ * block is never filtered half with the old state.
+ * 
+ * \param ch Channel index
+ * \param type Filter type
+ * \param param Boxcar factor (1..DSP_BOXCAR_MAX), IIR shift (1..DSP_IIR_SHIFT_MAX) or median window (3 or 5); ignored for DSP_NONE
+ * \return 0 on success, -EINVAL for an invalid channel or parameter
+ */
+int dsp_set(int ch, enum dsp_filter type, int param);
+
+/** \brief DSP decimation
+ * 
+ * Called by the acquisition context first for each block of a channel: applies a filter
+ * requested by dsp_set() since the previous block.
+ * 
+ * \param ch Channel index
+ * \return number of input samples per output sample of the channel's filter
+ */
+int dsp_decimation(int ch);
+
+/** \brief DSP pending
+ * 
+ * \param ch Channel index
+ * \return number of samples already in the unfinished boxcar group (0 for the other filters)
+ */
+int dsp_pending(int ch);
+
+/** \brief DSP process
+ * 
+ * Filters a block of raw samples of one channel. With p = dsp_pending(ch) before the call
+ * and d = dsp_decimation(ch), output j corresponds to input (d - 1 - p + j * d).
+ * 
+ * \param ch Channel index
+ * \param in First input sample
+ * \param stride Distance between two input samples (1 for contiguous, the scan width for interleaved blocks)
+ * \param out Output, contiguous
+ * \param n Number of input samples
+ * \return number of output samples
+ */
+size_t dsp_process(int ch, const uint16_t *in, size_t stride, uint16_t *out, size_t n);
+
+#endif /* GMTDSP_H_ */
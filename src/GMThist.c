@@ -0,0 +1,247 @@
+/**
+ * \file GMThist.c
+ * 
+ * \brief Compressed sample history code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/timing/timing.h>   /* for timing services */
+#include <string.h>
+#include "GMThist.h"
+#include "GMTadc.h"
+
+/** Block: keyframe, then one coded sample after the other (see hist_encode()) */
+struct hist_block {
+    uint32_t t0;                /**< Keyframe timestamp (in us) */
+    uint16_t raw0;              /**< Keyframe raw value */
+    uint8_t count;              /**< Samples in the block, keyframe included */
+    uint8_t used;               /**< Bytes of data in use */
+    uint8_t data[HIST_BLOCK_BYTES - HIST_KEY_BYTES];
+};
+
+BUILD_ASSERT(sizeof(struct hist_block) == HIST_BLOCK_BYTES, "history block must have no padding");
+BUILD_ASSERT(HIST_BLOCK_MAX_SAMPLES <= UINT8_MAX, "history block count is 8 bits wide");
+
+struct hist_channel {
+    struct hist_block blocks[HIST_BLOCKS];
+    uint32_t opened;            /**< Blocks opened since start; the newest is (opened - 1) % HIST_BLOCKS */
+    atomic_t seq;               /**< Odd while a block is being written */
+
+    /* Encoder state, writer only */
+    uint32_t t_prev;
+    uint32_t dt_prev;
+    uint16_t raw_prev;
+
+    /* Codec figures */
+    uint64_t encode_cycles;
+    uint32_t encoded;
+    uint64_t decode_cycles;
+    uint32_t decoded;
+};
+
+static struct hist_channel hist[NUM_CHANNELS];
+
+static inline uint32_t hist_zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t hist_unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/* Writes v as a varint (7 bits per byte, low first); returns the number of bytes */
+static int hist_put_varint(uint8_t *p, uint64_t v)
+{
+    int n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static int hist_get_varint(const uint8_t *p, int len, uint64_t *v)
+{
+    uint64_t value = 0;
+
+    for (int n = 0, shift = 0; n < len && shift < 64; n++, shift += 7) {
+        value |= (uint64_t)(p[n] & 0x7f) << shift;
+        if (!(p[n] & 0x80)) {
+            *v = value;
+            return n + 1;
+        }
+    }
+    return -EINVAL;
+}
+
+/* A sample is one varint holding the zig-zag timestamp delta-of-delta above HIST_RAW_BITS bits of
+ * zig-zag raw delta, so that a jittered timestamp and a noisy value share two bytes. A raw delta
+ * that does not fit leaves HIST_RAW_ESC there and follows as a second varint (minus HIST_RAW_ESC). */
+static int hist_encode(uint8_t *p, int32_t draw, int32_t ddt)
+{
+    const uint32_t zr = hist_zigzag(draw);
+    int n;
+
+    n = hist_put_varint(p, ((uint64_t)hist_zigzag(ddt) << HIST_RAW_BITS) | MIN(zr, HIST_RAW_ESC));
+    if (zr >= HIST_RAW_ESC) {
+        n += hist_put_varint(&p[n], zr - HIST_RAW_ESC);
+    }
+    return n;
+}
+
+static int hist_decode(const uint8_t *p, int len, int32_t *draw, int32_t *ddt)
+{
+    uint64_t head, esc = 0;
+    int n, m = 0;
+
+    n = hist_get_varint(p, len, &head);
+    if (n < 0) {
+        return n;
+    }
+    if ((head & HIST_RAW_ESC) == HIST_RAW_ESC) {
+        m = hist_get_varint(&p[n], len - n, &esc);
+        if (m < 0) {
+            return m;
+        }
+    }
+    *draw = hist_unzigzag((uint32_t)((head & HIST_RAW_ESC) + esc));
+    *ddt = hist_unzigzag((uint32_t)(head >> HIST_RAW_BITS));
+    return n + m;
+}
+
+void hist_push(int ch, uint32_t timestamp, uint16_t raw)
+{
+    struct hist_channel *hc = &hist[ch];
+    timing_t start = timing_counter_get();
+    timing_t end;
+    uint8_t code[10];
+    bool appended = false;
+
+    if (hc->opened > 0) {
+        struct hist_block *blk = &hc->blocks[(hc->opened - 1) % HIST_BLOCKS];
+        uint32_t dt = timestamp - hc->t_prev;
+        int n;
+
+        n = hist_encode(code, (int32_t)raw - hc->raw_prev, (int32_t)(dt - hc->dt_prev));
+        if (blk->used + n <= sizeof(blk->data)) {
+            atomic_inc(&hc->seq);
+            compiler_barrier();
+            memcpy(&blk->data[blk->used], code, n);
+            blk->used += n;
+            blk->count++;
+            compiler_barrier();
+            atomic_inc(&hc->seq);
+            hc->dt_prev = dt;
+            appended = true;
+        }
+    }
+    if (!appended) {
+        /* New block, keyframe: overwrites the oldest one when the ring is full */
+        struct hist_block *blk = &hc->blocks[hc->opened % HIST_BLOCKS];
+
+        atomic_inc(&hc->seq);
+        compiler_barrier();
+        blk->t0 = timestamp;
+        blk->raw0 = raw;
+        blk->count = 1;
+        blk->used = 0;
+        hc->opened++;
+        compiler_barrier();
+        atomic_inc(&hc->seq);
+        hc->dt_prev = 0;
+    }
+    hc->t_prev = timestamp;
+    hc->raw_prev = raw;
+
+    end = timing_counter_get();
+    hc->encode_cycles += timing_cycles_get(&start, &end);
+    hc->encoded++;
+}
+
+int hist_blocks(int ch)
+{
+    if (ch < 0 || ch >= NUM_CHANNELS) {
+        return 0;
+    }
+    return MIN(hist[ch].opened, HIST_BLOCKS);
+}
+
+int hist_read(int ch, int age, struct adc_ts_sample *out, int max)
+{
+    struct hist_channel *hc;
+    struct hist_block blk;
+    atomic_val_t seq;
+    timing_t start, end;
+    uint32_t t, dt = 0;
+    int32_t raw;
+    int pos = 0, n = 0;
+
+    if (ch < 0 || ch >= NUM_CHANNELS || age < 0 || max < 1) {
+        return -EINVAL;
+    }
+    hc = &hist[ch];
+    do {
+        seq = atomic_get(&hc->seq);
+        compiler_barrier();
+        if (age >= MIN(hc->opened, HIST_BLOCKS)) {
+            return -EINVAL;
+        }
+        blk = hc->blocks[(hc->opened - 1 - age) % HIST_BLOCKS];
+        compiler_barrier();
+    } while ((seq & 1) || seq != atomic_get(&hc->seq));
+
+    start = timing_counter_get();
+    t = blk.t0;
+    raw = blk.raw0;
+    out[n++] = (struct adc_ts_sample){.timestamp = t, .original_value = (uint16_t)raw};
+    while (n < blk.count && n < max) {
+        int32_t dv, ddt;
+        int len;
+
+        len = hist_decode(&blk.data[pos], blk.used - pos, &dv, &ddt);
+        if (len < 0) {
+            break;
+        }
+        pos += len;
+        raw += dv;
+        dt += (uint32_t)ddt;
+        t += dt;
+        out[n++] = (struct adc_ts_sample){.timestamp = t, .original_value = (uint16_t)raw};
+    }
+    for (int i = 0; i < n; i++) {
+        adc_convert_block(ch, &out[i].original_value, 1, &out[i].converted_value, 1);
+    }
+    end = timing_counter_get();
+    hc->decode_cycles += timing_cycles_get(&start, &end);
+    hc->decoded += n;
+    return n;
+}
+
+int hist_get_stats(int ch, struct hist_stats *stats)
+{
+    const struct hist_channel *hc;
+    int blocks = hist_blocks(ch);
+
+    if (ch < 0 || ch >= NUM_CHANNELS) {
+        return -EINVAL;
+    }
+    hc = &hist[ch];
+    *stats = (struct hist_stats){.bytes = blocks * HIST_BLOCK_BYTES, .encoded = hc->encoded, .decoded = hc->decoded};
+    for (int age = 0; age < blocks; age++) {
+        stats->samples += hc->blocks[(hc->opened - 1 - age) % HIST_BLOCKS].count;
+    }
+    stats->encode_ns = (uint32_t)(timing_cycles_to_ns(hc->encode_cycles) / MAX(hc->encoded, 1));
+    stats->decode_ns = (uint32_t)(timing_cycles_to_ns(hc->decode_cycles) / MAX(hc->decoded, 1));
+    return 0;
+}
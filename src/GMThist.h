@@ -0,0 +1,84 @@
+/**
+ * \file GMThist.h
+ * 
+ * \brief Compressed sample history header
+ * 
+ * Keeps a longer history of each channel than the RTDB rings in about the same RAM.
+ * Only raw samples are stored (converted values are derived on decode with the channel's
+ * current calibration). Each channel owns a ring of fixed-size blocks; every block starts
+ * with a keyframe (timestamp and raw value) and each following sample is one varint packing
+ * the zig-zag timestamp delta-of-delta with the zig-zag raw value delta (HIST_RAW_BITS bits, a
+ * larger delta follows as a second varint). A steady sample takes one byte, and most samples with
+ * +/-100 us of jitter and +/-10 codes of noise two. Blocks are large enough that the keyframes and
+ * the block still being filled leave over 3 times the samples of an RTDB ring in the same RAM at
+ * that jitter. A block is decoded on its own, so any block can be read without the ones before it.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTHIST_H_
+#define GMTHIST_H_
+
+#include <stdint.h>
+#include "rtdb.h"
+
+#define HIST_ENABLE 1 /**< 1: every sample pushed to the RTDB rings is also stored compressed */
+#define HIST_BLOCK_BYTES 128 /**< Size of a block, keyframe included */
+#define HIST_BLOCKS 8 /**< Blocks per channel (HIST_BLOCKS * HIST_BLOCK_BYTES bytes of RAM per channel) */
+#define HIST_KEY_BYTES 8 /**< Size of the keyframe header of a block */
+#define HIST_BLOCK_MAX_SAMPLES (1 + (HIST_BLOCK_BYTES - HIST_KEY_BYTES)) /**< A coded sample takes at least 1 byte */
+#define HIST_RAW_BITS 5 /**< Bits of the zig-zag raw delta packed with the timestamp delta-of-delta */
+#define HIST_RAW_ESC ((1U << HIST_RAW_BITS) - 1) /**< Raw delta field value: the delta follows in its own varint */
+
+/** Storage and codec figures of a channel */
+struct hist_stats {
+    uint32_t samples;           /**< Samples held */
+    uint32_t bytes;             /**< Bytes of the blocks holding them */
+    uint32_t encoded;           /**< Samples encoded since start */
+    uint32_t encode_ns;         /**< Mean encode time per sample (in ns) */
+    uint32_t decoded;           /**< Samples decoded since start */
+    uint32_t decode_ns;         /**< Mean decode time per sample (in ns) */
+};
+
+/** \brief History push
+ * 
+ * Appends one sample of a channel, opening a new block (and dropping the oldest) when the
+ * current one is full. Called by the single writer of the channel, from rtdb_ring_push().
+ * 
+ * \param ch Channel index
+ * \param timestamp Time of the conversion (in us)
+ * \param raw Raw value
+ */
+void hist_push(int ch, uint32_t timestamp, uint16_t raw);
+
+/** \brief History blocks
+ * 
+ * \param ch Channel index
+ * \return number of blocks holding samples, 0..HIST_BLOCKS
+ */
+int hist_blocks(int ch);
+
+/** \brief History read
+ * 
+ * Decodes one block of a channel. Never blocks; retries if the writer changed the block meanwhile.
+ * 
+ * \param ch Channel index
+ * \param age Block, 0 for the newest (still being filled) up to hist_blocks() - 1 for the oldest
+ * \param out Decoded samples, oldest first, with converted values
+ * \param max Room in out, HIST_BLOCK_MAX_SAMPLES is always enough
+ * \return number of samples, -EINVAL for an invalid channel or block
+ */
+int hist_read(int ch, int age, struct adc_ts_sample *out, int max);
+
+/** \brief History stats
+ * 
+ * \param ch Channel index
+ * \param stats Destination
+ * \return 0 on success, -EINVAL for an invalid channel
+ */
+int hist_get_stats(int ch, struct hist_stats *stats);
+
+#endif /* GMTHIST_H_ */
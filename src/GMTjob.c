@@ -0,0 +1,423 @@
+/**
+ * \file GMTjob.c
+ * 
+ * \brief Jobs of the application code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>    /* for GPIO API*/
+#include <zephyr/drivers/pwm.h>		/* For PWM api */
+#include <zephyr/drivers/uart.h>    /* for UART*/
+#include <zephyr/timing/timing.h>   /* for timing services */
+#include <zephyr/sys/printk.h>      /* for printk()*/
+#include <zephyr/sys/util.h>
+#include "GMTjob.h"
+#include "GMTadc.h"
+#include "GMTpwm.h"
+#include "rtdb.h"
+#include "GMTlog.h"
+#include "GMTcmd.h"
+#include "GMTtelem.h"
+#include "GMTctrl.h"
+#include "GMTwave.h"
+#include "GMTrec.h"
+
+/* Periodic release engine of each periodic thread */
+struct ptask task_print;/**< release grid and counters of the print thread*/
+struct ptask task_an;/**< release grid and counters of the analog input thread*/
+struct ptask task_pwm;/**< release grid and counters of the PWM thread*/
+struct ptask task_cmd;/**< counters of the command thread (event driven, no release grid)*/
+
+static struct rtdb_sub pwm_sub;/**< RTDB notifications of the PWM thread*/
+
+static volatile int res = 1;/**< Result of the last command*/
+static int errorcount = 0;
+static void (*cmd_hook)(int result);/**< Called after each command, see job_set_cmd_hook()*/
+
+static uint8_t rx_buf[2][Receive_Buff_Size] = {0}; /**< Define the Rx buffers, the driver fills one while the other is parsed*/
+static int rx_next = 1; /**< Rx buffer to hand to the driver on the next request*/
+
+/* Job prototypes */
+static void print_job(void);
+static void an_job(void);
+static void an_output(void);
+static void pwm_job(void);
+static void cmd_job(const struct cmd_frame *frame);
+
+void job_init(void)
+{
+    ptask_init(&task_print, "print", thread_print_period, thread_print_policy);
+    ptask_init(&task_an, "analog", thread_an_period_init, thread_an_policy);
+    ptask_init(&task_pwm, "pwm", thread_pwm_period_init, thread_pwm_policy);
+    ptask_init(&task_cmd, "cmd", 0, PTASK_SKIP);
+    rtdb_subscribe(&pwm_sub, 0, PWM_CHANGE_MV);
+}
+
+void job_set_cmd_hook(void (*hook)(int result))
+{
+    cmd_hook = hook;
+}
+
+int job_errors(void)
+{
+    return errorcount;
+}
+
+/** \brief UART callback function
+ * 
+ * Every received chunk is fed, in place, to the command frame parser.
+ * The two receive buffers are alternated so reception never stops between chunks.
+ * 
+ */
+static void uart_cb(const struct device *dev, struct uart_event *evt, void *user_data){
+	switch (evt->type) {
+
+	case UART_RX_RDY:
+		cmd_rx(&evt->data.rx.buf[evt->data.rx.offset], evt->data.rx.len);
+		break;
+
+	case UART_RX_BUF_REQUEST:
+		uart_rx_buf_rsp(dev, rx_buf[rx_next], sizeof(rx_buf[rx_next]));
+		rx_next ^= 1;
+		break;
+
+	case UART_RX_DISABLED:
+		rx_next = 1;
+		uart_rx_enable(dev, rx_buf[0], sizeof(rx_buf[0]), Receive_Timeout);
+		break;
+		
+	default:
+		break;
+    }
+}
+
+/** \brief Telemetry UART callback function
+ * 
+ * Completed transmissions release the telemetry buffer that was being sent.
+ * 
+ */
+static void telem_uart_cb(const struct device *dev, struct uart_event *evt, void *user_data){
+	switch (evt->type) {
+
+	case UART_TX_DONE:
+	case UART_TX_ABORTED:
+		telem_tx_done();
+		break;
+
+	default:
+		break;
+    }
+}
+
+int job_uart_start(const struct device *dev)
+{
+    int ret = uart_callback_set(dev, uart_cb, NULL);
+
+    if (ret) {
+        return ret;
+    }
+    rx_next = 1;
+    return uart_rx_enable(dev, rx_buf[0], sizeof(rx_buf[0]), Receive_Timeout);
+}
+
+int job_telem_uart_start(const struct device *dev)
+{
+    int ret = uart_callback_set(dev, telem_uart_cb, NULL);
+
+    if (ret) {
+        return ret;
+    }
+    telem_init(dev);
+    return 0;
+}
+
+/** \brief Printing Thread for the values of analog inputs and the periods of the threads
+ * 
+ * This periodic thread with static period prints out the values
+ * of the analog inputs converted into volts and also the PWM output
+ * 
+*/
+void thread_print_code(void *argA , void *argB, void *argC){
+	printk("Thread print init (periodic)\n");
+
+	/* First release now */
+	ptask_start(&task_print);
+
+	while(1){
+		print_job();
+
+		/* Wait for next release instant */ 
+		ptask_wait_next(&task_print);
+	}
+	timing_stop();
+}
+
+/** \brief Print job
+ * 
+ * One job of the print task: in text debug mode, prints the periods of the threads.
+ * 
+*/
+static void print_job(void){
+#if TELEM_TEXT
+	// PRINT ADC STATES AND THREAD PERIODS
+	printk("\r");
+	printk("Analog Read Period: %d  \n\r",task_an.period);
+	printk("\r");
+
+	// PRINT PWM?
+	printk("\r");
+	printk("PWM Period: %d  \n\r",task_pwm.period);
+	printk("\r");
+	printk("\r");
+#endif
+}
+
+
+/** \brief ADC reading thred
+ * 
+ * This thread implements reading the Analog Entries and the ADCs.
+ * This is a periodic thread whose period can be changed via UART input.
+ * 
+ * 
+*/
+void thread_an_code(void *argA , void *argB, void *argC){
+
+
+
+#if ADC_STREAMING
+	/* Streaming mode: the ADC paces the scans, the thread only wakes up once per block */
+	if (adc_stream_start() != 0) {
+		errorcount ++;
+	}
+	while(true){
+		if (adc_stream_next() != 0) {
+			errorcount ++;
+		}
+		an_output();
+	}
+#endif
+
+	/* First release now */
+	ptask_start(&task_an);
+
+	/* Main loop */
+	while(true){
+		/* High-rate mode selected by command: paced by the counter or the ADC until deselected;
+		 * started again after a block overrun */
+		if (adc_hr_period() != 0) {
+			if (adc_hr_run() != 0) {
+				errorcount ++;
+			}
+			ptask_start(&task_an);
+			continue;
+		}
+
+		an_job();
+		
+		/* Wait for next release instant */ 
+		ptask_wait_next(&task_an);
+	}
+	timing_stop();
+}
+
+/** \brief Analog input job
+ * 
+ * One job of the analog input task in the periodic mode.
+ * 
+*/
+static void an_job(void){
+	/*
+	Process:
+	0. Apply a staged batch of settings (cycle boundary)
+	1. Scan all channels and publish the snapshot to the RTDB
+	2. Save the value of err so it can be sent out of the UART
+	3. Send the snapshot as telemetry
+	*/
+	cmd_commit();
+	if (adc_collect() != 0) {
+		errorcount ++;
+	}
+	an_output();
+}
+
+/** \brief Analog output
+ * 
+ * Sends the latest snapshot as binary telemetry and, in text debug mode, prints it.
+ * 
+*/
+static void an_output(void){
+#if TELEM_ENABLE
+	struct adc_value_container snapshot;
+
+	rtdb_adc_read(&snapshot);
+	telem_push(&snapshot);
+#endif
+#if TELEM_TEXT
+	adc_print();
+#endif
+}
+
+/** \brief PWM Thread
+ * 
+ * This is a thread that implements the PWM output.
+ * It is periodic and the peirod can be changed via UART input, which also changes the output.
+ * In control mode the output is instead computed by the PID from one analog input, at the rate of this thread.
+ * With PWM_ON_CHANGE, mapped outputs are updated when the RTDB notifies a change of their inputs.
+ * 
+*/
+void thread_pwm_code(void *argA , void *argB, void *argC){
+
+	/* First release now */
+	ptask_start(&task_pwm);
+	
+	while(1){
+		pwm_job();
+
+#if PWM_ON_CHANGE
+		/* Outputs follow inputs: next job when one of their inputs changes. The PID and the
+		 * waveform own the output with their own rate, so they stay on the release grid.
+		 * Each job is counted like a periodic one, released at the conversion of the sample
+		 * that notified it (or at the timeout), and the admission test counts a job per
+		 * analog job when that is more often than the PWM period */
+		if (pwm_bank_mapped() && !ctrl_enabled() && !wave_playing()) {
+			struct adc_value_container snapshot;
+			int64_t release;
+
+			ptask_event_end(&task_pwm);
+			ptask_set_release_src(&task_pwm, &task_an);
+			rtdb_sub_filter(&pwm_sub, pwm_bank_channels(), PWM_CHANGE_MV);
+			if (rtdb_wait(&pwm_sub, &snapshot, K_MSEC(task_pwm.period)) == 0) {
+				release = k_uptime_ticks();
+				release -= k_us_to_ticks_floor64((uint32_t)k_ticks_to_us_floor64(release) - snapshot.timestamp);
+			}
+			else {
+				release = k_uptime_ticks();
+			}
+			ptask_event_begin(&task_pwm, release);
+			continue;
+		}
+		ptask_set_release_src(&task_pwm, NULL);
+#endif
+		/* Wait for next release instant */ 
+		ptask_wait_next(&task_pwm);
+	}
+	timing_stop();
+}
+
+/** \brief PWM job
+ * 
+ * One job of the PWM task: waveform playback, control mode, mapped bank or the legacy output.
+ * 
+*/
+static void pwm_job(void){
+	static int div = 1; /* Divider for computing the duty-cycle */
+
+	/* Settings of a batch command take effect together, here */
+	cmd_commit();
+
+	/* Toggle led1 */
+	gpio_pin_toggle_dt(&led1);
+
+	/* Waveform playback owns the output, its timer writes the duty cycles */
+	if (wave_playing()) {
+		return;
+	}
+
+	/* Control mode: sample, PID and new duty cycle in this same job */
+	if (ctrl_enabled()) {
+		if (ctrl_step() != 0) {
+			errorcount ++;
+		}
+		return;
+	}
+
+	/* Outputs mapped to analog inputs: all duty cycles of this cycle applied as one batch */
+	if (pwm_bank_mapped()) {
+		struct adc_value_container snapshot;
+
+		rtdb_adc_read(&snapshot);
+		pwm_bank_from_adc(snapshot.converted_values);
+		if (pwm_bank_apply() < 0) {
+			errorcount ++;
+		}
+		return;
+	}
+
+	/* Adjust the brightness of led0 (associated with pwm) 
+	* PWM_NLEVELS levels of intensity, which are actually dividers that set the duty-cycle */
+	div = CLAMP(100 - ((task_pwm.period - 500) * 99) / 4500, 1, 100);
+	
+	dlog_push(DLOG_PWM_DIV, div, 0, 0);
+	
+	pwm_set_dt(&pwm_led0, PWM_PERIOD, (PWM_PERIOD)/((unsigned int)div)); /* args are period and Ton */
+}
+
+/** \brief Thread de comandos
+ * 
+ * This thread implements commands and does their verification
+ * This thread is event driven: it blocks until the UART callback queues a complete command frame
+ * 
+*/
+void thread_cmd_code(void *argA , void *argB, void *argC){
+	struct cmd_frame frame;
+
+	while(1){
+		cmd_get(&frame, K_FOREVER);
+		cmd_job(&frame);
+	}
+}
+
+/** \brief Command job
+ * 
+ * Processes one command frame.
+ * 
+*/
+static void cmd_job(const struct cmd_frame *frame){
+	ptask_exec_begin(&task_cmd);
+	res = cmdProcess(frame);
+	ptask_exec_end(&task_cmd);
+	printk("\n\rcmdProcess output: %d\n\r", res);
+	if (cmd_hook != NULL) {
+		cmd_hook(res);
+	}
+}
+
+/** \brief Log drain thread
+ * 
+ * This low priority thread formats the records pushed to the deferred log by the other threads,
+ * so that no console output is done in the sampling and PWM paths.
+ * 
+*/
+void thread_log_code(void *argA , void *argB, void *argC){
+
+	while(1){
+		dlog_drain();
+		k_msleep(DLOG_DRAIN_PERIOD);
+	}
+}
+
+/** \brief Flash recorder thread
+ * 
+ * This lowest priority thread packs every new RTDB snapshot in RAM and writes full chunks to flash,
+ * so the flash writes and erases never delay the acquisition.
+ * 
+*/
+void thread_rec_code(void *argA , void *argB, void *argC){
+
+#if REC_ENABLE
+	if (rec_init() != 0) {
+		return;
+	}
+	while(1){
+		if (rec_collect(K_FOREVER) < 0) {
+			errorcount ++;
+		}
+	}
+#endif
+}
@@ -0,0 +1,91 @@
+/**
+ * \file GMTjob.h
+ *
+ * \brief Jobs of the application header
+ *
+ * The periodic tasks, the code of every thread with its jobs and the callbacks of both UARTs.
+ * main.c only configures the devices and creates the threads; the test suite (tests/io) links
+ * this module and runs the same thread code on the emulated devices.
+ *
+ * \version 1.0
+ *
+ * \date 05-07-2023
+ *
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTJOB_H_
+#define GMTJOB_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include "GMTtask.h"
+
+/* Initial period (in ms) and overrun policy of each periodic task */
+#define thread_print_period 1000 /**< Print thread static period */
+#define thread_an_period_init 1000 /**< Analog input thread initial period - can vary via UART*/
+#define thread_pwm_period_init 1000 /**< PWM thread initial period - can vary via UART*/
+#define thread_print_policy PTASK_SKIP /**< A late print is simply dropped */
+#define thread_an_policy PTASK_SKIP /**< Missed samples are lost anyway, stay on the grid */
+#define thread_pwm_policy PTASK_COMPRESS /**< Apply the latest output right away */
+
+/* While PWM outputs are mapped to analog inputs, the PWM thread can run on RTDB notifications
+ * instead of its release grid: one job per relevant snapshot, with its period as the longest wait */
+#define PWM_ON_CHANGE 1 /**< 1: mapped outputs are updated when their inputs change, 0: periodically */
+#define PWM_CHANGE_MV 10 /**< Input change (in mV) that updates the mapped outputs, 0 for every new sample */
+
+#define Receive_Buff_Size 32 /**< Define the size of each of the two receive buffers*/
+#define Receive_Timeout 100 /**< Define the UART timeout period*/
+
+/* Periodic release engine of each thread; task_an and task_pwm are also declared by GMTcmd.h */
+extern struct ptask task_print;/**< release grid and counters of the print thread*/
+extern struct ptask task_cmd;/**< counters of the command thread (event driven, no release grid)*/
+
+/** \brief Job init
+ *
+ * Registers the periodic tasks with their initial periods and the RTDB subscriber of the PWM
+ * thread. Called once, after RTDB_init().
+ */
+void job_init(void);
+
+/** \brief Job UART start
+ *
+ * Installs the command UART callback and starts reception: every received chunk is fed, in place,
+ * to the command frame parser, from two alternating buffers.
+ *
+ * \param dev Command UART
+ * \return 0 on success, negative error code on failure
+ */
+int job_uart_start(const struct device *dev);
+
+/** \brief Job telemetry UART start
+ *
+ * Installs the telemetry UART callback and hands the UART to the telemetry.
+ *
+ * \param dev Telemetry UART, transmit only
+ * \return 0 on success, negative error code on failure
+ */
+int job_telem_uart_start(const struct device *dev);
+
+/** \brief Job set command hook
+ *
+ * hook is called by the command thread after each frame, with the value returned by cmdProcess()
+ *
+ * \param hook Function called, NULL for none
+ */
+void job_set_cmd_hook(void (*hook)(int result));
+
+/** \brief Job errors
+ *
+ * \return number of failed acquisitions, control steps and PWM bank writes so far
+ */
+int job_errors(void);
+
+/* Thread code, the entry of each thread created by main() */
+void thread_print_code(void *argA , void *argB, void *argC);
+void thread_an_code(void *argA , void *argB, void *argC);
+void thread_pwm_code(void *argA , void *argB, void *argC);
+void thread_cmd_code(void *argA , void *argB, void *argC);
+void thread_log_code(void *argA , void *argB, void *argC);
+void thread_rec_code(void *argA , void *argB, void *argC);
+
+#endif /* GMTJOB_H_ */
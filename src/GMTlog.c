@@ -0,0 +1,122 @@
+/**
+ * \file GMTlog.c
+ * 
+ * \brief Deferred binary logging code
+ * 
+ * The ring is a bounded multi-producer, single-consumer queue: each slot carries a
+ * sequence number telling whether it is free for position pos (seq == pos) or holds
+ * the record of position pos (seq == pos + 1). Producers claim positions with a
+ * compare-and-swap on the head, so no lock is ever taken.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/printk.h>      /* for printk()*/
+#include "GMTlog.h"
+
+BUILD_ASSERT((DLOG_RING_SIZE & (DLOG_RING_SIZE - 1)) == 0, "DLOG_RING_SIZE must be a power of two");
+
+struct dlog_record {
+    atomic_t seq;
+    uint8_t id;
+    uint32_t args[DLOG_MAX_ARGS];
+};
+
+static struct dlog_record dlog_ring[DLOG_RING_SIZE];
+static atomic_t dlog_head;          /**< Next position to be claimed by a producer */
+static uint32_t dlog_tail;          /**< Next position to be read by the drain thread */
+static atomic_t dlog_drops;
+static uint32_t dlog_drops_reported;
+static bool dlog_deferred = DLOG_DEFERRED;
+
+static const char *const dlog_formats[DLOG_EVENT_COUNT] = {
+    [DLOG_ADC_READING] = "adc %u reading: %4u mV: \n\r",
+    [DLOG_ADC_RANGE] = "adc %u reading out of rang(value is %u)\n\r",
+    [DLOG_PWM_DIV] = "PWM divider set to %d\n\r",
+    [DLOG_PWM_BANK] = "PWM bank outputs 0x%x set (%u)\n\r",
+    [DLOG_CMD_BATCH] = "$B,%d&\n\r",
+};
+
+void dlog_init(void)
+{
+    for (int i = 0; i < DLOG_RING_SIZE; i++) {
+        atomic_set(&dlog_ring[i].seq, i);
+    }
+    atomic_set(&dlog_head, 0);
+    dlog_tail = 0;
+    atomic_set(&dlog_drops, 0);
+    dlog_drops_reported = 0;
+}
+
+void dlog_set_deferred(bool deferred)
+{
+    dlog_deferred = deferred;
+}
+
+void dlog_push(enum dlog_event id, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+    struct dlog_record *rec;
+    uint32_t pos = atomic_get(&dlog_head);
+
+    if (!dlog_deferred) {
+        printk(dlog_formats[id], a0, a1, a2);
+        return;
+    }
+
+    while (1) {
+        rec = &dlog_ring[pos & (DLOG_RING_SIZE - 1)];
+        int32_t diff = (int32_t)((uint32_t)atomic_get(&rec->seq) - pos);
+
+        if (diff == 0) {
+            if (atomic_cas(&dlog_head, pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* Slot still holds a record one lap behind: ring full */
+            atomic_inc(&dlog_drops);
+            return;
+        }
+        pos = atomic_get(&dlog_head);
+    }
+
+    rec->id = id;
+    rec->args[0] = a0;
+    rec->args[1] = a1;
+    rec->args[2] = a2;
+    atomic_set(&rec->seq, pos + 1);     /* publish */
+}
+
+int dlog_drain(void)
+{
+    int n = 0;
+
+    while (1) {
+        struct dlog_record *rec = &dlog_ring[dlog_tail & (DLOG_RING_SIZE - 1)];
+
+        if ((uint32_t)atomic_get(&rec->seq) != dlog_tail + 1) {
+            break;
+        }
+        printk(dlog_formats[rec->id], rec->args[0], rec->args[1], rec->args[2]);
+        atomic_set(&rec->seq, dlog_tail + DLOG_RING_SIZE);     /* free for the next lap */
+        dlog_tail++;
+        n++;
+    }
+
+    uint32_t drops = atomic_get(&dlog_drops);
+    if (drops != dlog_drops_reported) {
+        printk("dlog: %u records dropped\n\r", drops - dlog_drops_reported);
+        dlog_drops_reported = drops;
+    }
+    return n;
+}
+
+uint32_t dlog_dropped(void)
+{
+    return atomic_get(&dlog_drops);
+}
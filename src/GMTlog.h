@@ -0,0 +1,78 @@
+/**
+ * \file GMTlog.h
+ * 
+ * \brief Deferred binary logging header
+ * 
+ * Hot paths push compact records (event id plus raw arguments) into a lock-free ring;
+ * a low priority thread formats and prints them later.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTLOG_H_
+#define GMTLOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DLOG_DEFERRED 1 /**< 1: records are formatted by the drain thread, 0: printed synchronously by the caller (see dlog_set_deferred()) */
+#define DLOG_RING_SIZE 64 /**< Number of records in the ring (power of two) */
+#define DLOG_MAX_ARGS 3 /**< Maximum number of arguments of a record */
+#define DLOG_DRAIN_PERIOD 100 /**< Period of the drain thread (in ms) */
+
+/** Event ids; each one has a format string in GMTlog.c */
+enum dlog_event {
+    DLOG_ADC_READING,       /**< channel, value in mV */
+    DLOG_ADC_RANGE,         /**< channel, raw value */
+    DLOG_PWM_DIV,           /**< divider */
+    DLOG_PWM_BANK,          /**< mask of the outputs written, number of outputs written */
+    DLOG_CMD_BATCH,         /**< result of a batch command, 0 or negative error code */
+    DLOG_EVENT_COUNT
+};
+
+/** \brief Deferred log init
+ * 
+ * Empties the ring and clears the dropped record counter
+ * 
+ */
+void dlog_init(void);
+
+/** \brief Deferred log set deferred
+ * 
+ * Selects at run time whether dlog_push() stores records for the drain thread or prints them
+ * synchronously, so both paths can be timed in one build. Starts as DLOG_DEFERRED.
+ * 
+ * \param deferred true: store records in the ring, false: print them in the caller
+ */
+void dlog_set_deferred(bool deferred);
+
+/** \brief Deferred log push
+ * 
+ * Stores one record in the ring without formatting it. Never blocks; safe from any thread or ISR.
+ * If the ring is full the record is dropped and counted. When not deferred, prints it instead.
+ * 
+ * \param id Event id
+ * \param a0 First argument
+ * \param a1 Second argument
+ * \param a2 Third argument
+ */
+void dlog_push(enum dlog_event id, uint32_t a0, uint32_t a1, uint32_t a2);
+
+/** \brief Deferred log drain
+ * 
+ * Formats and prints every pending record, then reports new drops. Must be called from a single thread.
+ * 
+ * \return number of records printed
+ */
+int dlog_drain(void);
+
+/** \brief Deferred log dropped
+ * 
+ * \return total number of records dropped because the ring was full
+ */
+uint32_t dlog_dropped(void);
+
+#endif /* GMTLOG_H_ */
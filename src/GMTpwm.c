@@ -17,6 +17,28 @@
 #include <zephyr/drivers/pwm.h>		/* For PWM api */
 #include <zephyr/sys/printk.h>      /* for printk()*/
 #include "GMTpwm.h"
+#include "GMTadc.h"
+#include "GMTlog.h"
+
+#if DT_NODE_HAS_PROP(PWM_BANK_NODE, pwms)
+#define PWM_BANK_SPEC(node, prop, idx) PWM_DT_SPEC_GET_BY_IDX(node, idx),
+static const struct pwm_dt_spec pwm_bank[PWM_NUM_OUTPUTS] = {
+	DT_FOREACH_PROP_ELEM(PWM_BANK_NODE, pwms, PWM_BANK_SPEC)
+};
+#else
+static const struct pwm_dt_spec pwm_bank[PWM_NUM_OUTPUTS] = {
+	PWM_DT_SPEC_GET(DT_ALIAS(pwm_led0)),
+};
+#endif
+
+static int8_t pwm_map[PWM_NUM_OUTPUTS] = {
+	[0 ... PWM_NUM_OUTPUTS - 1] = PWM_UNMAPPED,
+};
+static uint16_t pwm_staged[PWM_NUM_OUTPUTS]; /**< Duty cycles to apply (per mille) */
+static uint32_t pwm_staged_mask; /**< Outputs staged since the last apply */
+static int32_t pwm_applied[PWM_NUM_OUTPUTS] = {
+	[0 ... PWM_NUM_OUTPUTS - 1] = -1, /* unknown: written on the first apply */
+};
 
 void pwm_init(void) {
     int ret;
@@ -24,5 +46,92 @@ void pwm_init(void) {
 		printk("Error: PWM device %s is not ready\n", pwm_led0.dev->name);
 		return;
 	}
+	for (int i = 0; i < PWM_NUM_OUTPUTS; i++) {
+		if (!device_is_ready(pwm_bank[i].dev)) {
+			printk("Error: PWM bank output %d device %s is not ready\n", i, pwm_bank[i].dev->name);
+		}
+	}
+
+}
+
+/* Outputs may have been written outside the bank: force the next apply to write them all */
+static void pwm_bank_invalidate(void)
+{
+	for (int i = 0; i < PWM_NUM_OUTPUTS; i++) {
+		pwm_applied[i] = -1;
+	}
+}
+
+int pwm_set_duty(uint32_t permille)
+{
+	pwm_bank_invalidate();
+	return pwm_set_dt(&pwm_led0, PWM_PERIOD, (PWM_PERIOD / 1000) * MIN(permille, 1000));
+}
+
+int pwm_bank_map(int out, int ch)
+{
+	if (out < 0 || out >= PWM_NUM_OUTPUTS || ch < PWM_UNMAPPED || ch >= NUM_CHANNELS) {
+		return -EINVAL;
+	}
+	pwm_map[out] = ch;
+	pwm_bank_invalidate();
+	return 0;
+}
+
+bool pwm_bank_mapped(void)
+{
+	return pwm_bank_channels() != 0;
+}
 
-}
\ No newline at end of file
+uint32_t pwm_bank_channels(void)
+{
+	uint32_t mask = 0;
+
+	for (int i = 0; i < PWM_NUM_OUTPUTS; i++) {
+		if (pwm_map[i] != PWM_UNMAPPED) {
+			mask |= BIT(pwm_map[i]);
+		}
+	}
+	return mask;
+}
+
+void pwm_bank_stage(int out, uint32_t permille)
+{
+	pwm_staged[out] = MIN(permille, 1000);
+	pwm_staged_mask |= BIT(out);
+}
+
+void pwm_bank_from_adc(const uint16_t *values)
+{
+	for (int i = 0; i < PWM_NUM_OUTPUTS; i++) {
+		if (pwm_map[i] != PWM_UNMAPPED) {
+			pwm_bank_stage(i, (uint32_t)values[pwm_map[i]] * 1000 / ADC_FULL_SCALE_MV);
+		}
+	}
+}
+
+int pwm_bank_apply(void)
+{
+	uint32_t written = 0; /* mask of the outputs written */
+	int n = 0;
+	int ret;
+
+	for (int i = 0; i < PWM_NUM_OUTPUTS; i++) {
+		/* Outputs that were not staged keep whatever they are driven with */
+		if (!(pwm_staged_mask & BIT(i)) || pwm_staged[i] == pwm_applied[i]) {
+			continue;
+		}
+		ret = pwm_set_dt(&pwm_bank[i], PWM_PERIOD, (PWM_PERIOD / 1000) * pwm_staged[i]);
+		if (ret) {
+			return ret;
+		}
+		pwm_applied[i] = pwm_staged[i];
+		written |= BIT(i);
+		n++;
+	}
+	pwm_staged_mask = 0;
+	if (n > 0) {
+		dlog_push(DLOG_PWM_BANK, written, n, 0);
+	}
+	return n;
+}
@@ -12,6 +12,10 @@
 #ifndef GMTPWM_H_
 #define GMTPWM_H_
 
+#include <zephyr/devicetree.h>	    /* for DT_NODELABEL() */
+#include <zephyr/drivers/gpio.h>    /* for GPIO API*/
+#include <zephyr/drivers/pwm.h>     /* for PWM API*/
+
 #define PWM_PERIOD 10000000 /* Value specified in ns */ 
 
 /* Get node IDs for LED1 and pwm0, noting that LED1 is labeld led0 in DTS file. */ 
@@ -22,6 +26,15 @@
 static const struct gpio_dt_spec led1 = GPIO_DT_SPEC_GET(LED1_NODE, gpios);
 static const struct pwm_dt_spec pwm_led0 = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led0));
 
+/* PWM bank: the outputs listed in the pwms property of the zephyr,user node, or pwm_led0 alone */
+#define PWM_BANK_NODE DT_PATH(zephyr_user) /**< Node holding the bank outputs */
+#if DT_NODE_HAS_PROP(PWM_BANK_NODE, pwms)
+#define PWM_NUM_OUTPUTS DT_PROP_LEN(PWM_BANK_NODE, pwms) /**< Number of outputs in the bank */
+#else
+#define PWM_NUM_OUTPUTS 1 /**< Number of outputs in the bank */
+#endif
+#define PWM_UNMAPPED (-1) /**< Output not driven by an analog input */
+
 /** \brief PWM init
  * 
  * This function initializes the PWM using the primitive function from the library
@@ -29,4 +42,62 @@ static const struct pwm_dt_spec pwm_led0 = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led0));
  */
 void pwm_init(void);
 
+/** \brief PWM set duty
+ * 
+ * Sets the duty cycle of the PWM output
+ * 
+ * \param permille Duty cycle, 0..1000
+ * \return 0 on success, negative error code on failure
+ */
+int pwm_set_duty(uint32_t permille);
+
+/** \brief PWM bank map
+ * 
+ * Selects the analog input that drives a bank output
+ * 
+ * \param out Output index
+ * \param ch ADC channel, or PWM_UNMAPPED
+ * \return 0 on success, -EINVAL for an invalid output or channel
+ */
+int pwm_bank_map(int out, int ch);
+
+/** \brief PWM bank mapped
+ * 
+ * \return true if at least one output is driven by an analog input
+ */
+bool pwm_bank_mapped(void);
+
+/** \brief PWM bank channels
+ * 
+ * \return bit mask of the analog inputs that drive at least one output
+ */
+uint32_t pwm_bank_channels(void);
+
+/** \brief PWM bank stage
+ * 
+ * Stores the duty cycle of an output, to be applied by pwm_bank_apply()
+ * 
+ * \param out Output index
+ * \param permille Duty cycle, 0..1000
+ */
+void pwm_bank_stage(int out, uint32_t permille);
+
+/** \brief PWM bank from ADC
+ * 
+ * Stages the duty cycle of every mapped output from its channel in a snapshot,
+ * 0 mV giving 0 and full scale giving 1000 per mille
+ * 
+ * \param values Converted values of the snapshot (in mV), one per ADC channel
+ */
+void pwm_bank_from_adc(const uint16_t *values);
+
+/** \brief PWM bank apply
+ * 
+ * Applies the duty cycles staged since the last apply in one pass; outputs that were not staged, or
+ * whose duty cycle did not change, are not written
+ * 
+ * \return number of outputs written, or a negative error code of the first failed write
+ */
+int pwm_bank_apply(void);
+
 #endif /* GMTPWM_H_ */
\ No newline at end of file
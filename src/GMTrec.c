@@ -0,0 +1,343 @@
+/**
+ * \file GMTrec.c
+ * 
+ * \brief Persistent snapshot recorder code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>      /* for printk()*/
+#include <string.h>
+#include "GMTrec.h"
+
+#if REC_ENABLE
+#include <zephyr/fs/fcb.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/timing/timing.h>   /* for timing services */
+#include "GMTcmd.h"                 /* for task_an */
+
+#define REC_PARTITION FIXED_PARTITION_ID(storage_partition) /**< Flash partition holding the FCB */
+#define REC_SECTOR_HDR_BYTES 8 /**< FCB sector header, programmed when a sector is opened */
+
+static struct flash_sector rec_sectors[REC_SECTORS_MAX];
+static struct fcb rec_fcb;
+static struct rtdb_sub rec_sub;
+
+/* RAM chunk and FCB, shared by the recorder thread and the commands */
+static K_MUTEX_DEFINE(rec_lock);
+static uint8_t rec_chunk[REC_CHUNK_RECORDS * REC_RECORD_BYTES];
+static int rec_fill;                    /**< Snapshots in rec_chunk */
+static uint32_t rec_last_seq;
+static const struct flash_sector *rec_last_sector;
+static struct rec_stats rec_stats;
+static uint32_t rec_gen;                /**< Bumped whenever recorded entries are erased */
+
+/* Logs the sector headers of the partition; returns the number of sectors formatted with another
+ * magic than REC_MAGIC, or a negative error code if the flash could not be read */
+static int rec_foreign_sectors(const struct flash_area *fa, uint32_t cnt)
+{
+    const uint32_t erased = flash_area_erased_val(fa) * 0x01010101U;
+    int foreign = 0;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        uint8_t hdr[REC_SECTOR_HDR_BYTES];
+        uint32_t magic;
+        int ret = flash_area_read(fa, rec_sectors[i].fs_off, hdr, sizeof(hdr));
+
+        if (ret) {
+            return ret;
+        }
+        magic = sys_get_le32(hdr);
+        printk("rec_init(): sector %u: magic 0x%08x, version %u, id %u\n\r", i, magic, hdr[4],
+               sys_get_le16(&hdr[6]));
+        if (magic != erased && magic != REC_MAGIC) {
+            foreign++;
+        }
+    }
+    return foreign;
+}
+
+int rec_init(void)
+{
+    uint32_t cnt = REC_SECTORS_MAX;
+    int ret;
+
+    ret = flash_area_get_sectors(REC_PARTITION, &cnt, rec_sectors);
+    if (ret) {
+        printk("rec_init(): flash_area_get_sectors() failed with code %d\n\r", ret);
+        return ret;
+    }
+    rec_fcb.f_magic = REC_MAGIC;
+    rec_fcb.f_version = 1;
+    rec_fcb.f_sectors = rec_sectors;
+    rec_fcb.f_sector_cnt = cnt;
+    rec_fcb.f_scratch_cnt = 0;
+
+    ret = fcb_init(REC_PARTITION, &rec_fcb);
+    if (ret == -ENOMSG) {
+        /* A sector of another owner: the partition is only taken over once its headers confirm it,
+         * never on a read error or another failure, and what it held is logged first */
+        const struct flash_area *fa;
+        int foreign;
+
+        ret = flash_area_open(REC_PARTITION, &fa);
+        if (ret == 0) {
+            foreign = rec_foreign_sectors(fa, cnt);
+            if (foreign > 0) {
+                printk("rec_init(): %d sectors of another format, erasing the storage partition\n\r", foreign);
+                ret = flash_area_erase(fa, 0, fa->fa_size);
+            }
+            else {
+                ret = (foreign < 0) ? foreign : -ENOMSG;
+            }
+            flash_area_close(fa);
+        }
+        if (ret == 0) {
+            ret = fcb_init(REC_PARTITION, &rec_fcb);
+        }
+    }
+    if (ret) {
+        printk("rec_init(): fcb_init() failed with code %d, storage partition left as is\n\r", ret);
+        return ret;
+    }
+    return rtdb_subscribe(&rec_sub, ADC_SCAN_MASK, 0);
+}
+
+/* Appends the RAM chunk to the FCB, erasing the oldest sector if the flash is full; lock held */
+static int rec_write(void)
+{
+    const uint16_t len = rec_fill * REC_RECORD_BYTES;
+    const uint32_t align = MAX(flash_area_align(rec_fcb.fap), 1);
+    struct fcb_entry loc;
+    timing_t start, end;
+    uint32_t an_lost;
+    int ret;
+
+    if (len == 0) {
+        return 0;
+    }
+    an_lost = task_an.missed + task_an.skipped;
+    start = timing_counter_get();
+    ret = fcb_append(&rec_fcb, len, &loc);
+    if (ret == -ENOSPC) {
+        const size_t erased = rec_fcb.f_oldest->fs_size;
+
+        ret = fcb_rotate(&rec_fcb);
+        if (ret == 0) {
+            rec_gen++;
+            rec_stats.erases++;
+            rec_stats.erase_bytes += erased;
+            ret = fcb_append(&rec_fcb, len, &loc);
+        }
+    }
+    if (ret == 0) {
+        ret = flash_area_write(rec_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), rec_chunk, len);
+    }
+    if (ret == 0) {
+        ret = fcb_append_finish(&rec_fcb, &loc);
+    }
+    end = timing_counter_get();
+    rec_stats.write_us += (uint32_t)(timing_cycles_to_ns(timing_cycles_get(&start, &end)) / 1000);
+    /* Releases the flash stalls cost the acquisition */
+    rec_stats.an_missed += task_an.missed + task_an.skipped - an_lost;
+
+    if (ret) {
+        printk("rec: chunk write failed with code %d\n\r", ret);
+        rec_stats.dropped += rec_fill;
+        rec_fill = 0;
+        return ret;
+    }
+    /* Programmed bytes: length field, data and CRC, each padded to the write block */
+    rec_stats.flash_bytes += ROUND_UP(len < 0x80 ? 1 : 2, align) + ROUND_UP(len, align) + ROUND_UP(1, align);
+    if (loc.fe_sector != rec_last_sector) {
+        rec_stats.flash_bytes += ROUND_UP(REC_SECTOR_HDR_BYTES, align);
+        rec_last_sector = loc.fe_sector;
+    }
+    rec_stats.chunks++;
+    rec_stats.payload_bytes += len;
+    rec_fill = 0;
+    return 0;
+}
+
+int rec_collect(k_timeout_t timeout)
+{
+    struct adc_value_container snapshot;
+    uint8_t *p;
+    int ret = rtdb_wait(&rec_sub, &snapshot, timeout);
+
+    if (ret) {
+        return ret;
+    }
+    k_mutex_lock(&rec_lock, K_FOREVER);
+    if (rec_stats.records > 0 && snapshot.seq != rec_last_seq + 1) {
+        rec_stats.dropped += snapshot.seq - rec_last_seq - 1;
+    }
+    rec_last_seq = snapshot.seq;
+
+    p = &rec_chunk[rec_fill++ * REC_RECORD_BYTES];
+    sys_put_le32(snapshot.seq, p);
+    sys_put_le32(snapshot.timestamp, p + 4);
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        sys_put_le16(snapshot.original_values[i], p + 8 + 2 * i);
+    }
+    rec_stats.records++;
+
+    if (rec_fill == REC_CHUNK_RECORDS) {
+        ret = rec_write();
+    }
+    k_mutex_unlock(&rec_lock);
+    return ret;
+}
+
+int rec_flush(void)
+{
+    int ret;
+
+    k_mutex_lock(&rec_lock, K_FOREVER);
+    ret = rec_write();
+    k_mutex_unlock(&rec_lock);
+    return ret;
+}
+
+static void rec_print(const uint8_t *p)
+{
+    printk("$R,%u,%u", sys_get_le32(p), sys_get_le32(p + 4));
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        printk(",%u", sys_get_le16(p + 8 + 2 * i));
+    }
+    printk("&\n\r");
+}
+
+int rec_dump(void)
+{
+    struct fcb_entry loc = {0};
+    uint8_t record[REC_RECORD_BYTES];
+    uint32_t gen, chunks = 0, next = 0, end;
+    uint16_t off = 0;
+    bool ram = false;                   /* past the last FCB entry, reading the RAM chunk */
+    int i = 0, count = 0;
+    int ret = 0;
+
+    /* The lock is only held to fetch one record, never while printing it */
+    k_mutex_lock(&rec_lock, K_FOREVER);
+    gen = rec_gen;
+    end = rec_last_seq;                 /* the snapshots recorded from now on are not dumped */
+    while (rec_stats.records > 0) {
+        /* Entries erased since the last record: walk again from the oldest one */
+        if (rec_gen != gen) {
+            gen = rec_gen;
+            loc = (struct fcb_entry){0};
+            off = 0;
+            ram = false;
+        }
+        /* The RAM chunk was written meanwhile: its records follow in flash */
+        if (ram && rec_stats.chunks != chunks) {
+            ram = false;
+        }
+        if (!ram) {
+            if (loc.fe_sector == NULL || off + REC_RECORD_BYTES > loc.fe_data_len) {
+                struct fcb_entry last = loc;
+
+                ret = fcb_getnext(&rec_fcb, &loc);
+                off = 0;
+                if (ret == -ENOTSUP) {
+                    /* No more entries; resume from the last one if the RAM chunk gets written */
+                    loc = last;
+                    ram = true;
+                    chunks = rec_stats.chunks;
+                    i = 0;
+                    ret = 0;
+                }
+                else if (ret) {
+                    break;
+                }
+                continue;
+            }
+            ret = flash_area_read(rec_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc) + off, record, sizeof(record));
+            if (ret) {
+                break;
+            }
+            off += REC_RECORD_BYTES;
+        }
+        else if (i < rec_fill) {
+            memcpy(record, &rec_chunk[i++ * REC_RECORD_BYTES], sizeof(record));
+        }
+        else {
+            break;
+        }
+        k_mutex_unlock(&rec_lock);
+
+        if ((int32_t)(sys_get_le32(record) - end) > 0) {
+            return count;
+        }
+        /* In sequence order; records already printed before a restart are skipped */
+        if (count == 0 || (int32_t)(sys_get_le32(record) - next) >= 0) {
+            rec_print(record);
+            next = sys_get_le32(record) + 1;
+            count++;
+        }
+        k_mutex_lock(&rec_lock, K_FOREVER);
+    }
+    k_mutex_unlock(&rec_lock);
+    return ret ? ret : count;
+}
+
+int rec_erase(void)
+{
+    int ret;
+
+    k_mutex_lock(&rec_lock, K_FOREVER);
+    ret = fcb_clear(&rec_fcb);
+    rec_gen++;
+    rec_fill = 0;
+    rec_last_sector = NULL;
+    k_mutex_unlock(&rec_lock);
+    return ret;
+}
+
+void rec_get_stats(struct rec_stats *stats)
+{
+    k_mutex_lock(&rec_lock, K_FOREVER);
+    *stats = rec_stats;
+    k_mutex_unlock(&rec_lock);
+}
+
+#else /* !REC_ENABLE */
+
+int rec_init(void)
+{
+    return -ENOTSUP;
+}
+
+int rec_collect(k_timeout_t timeout)
+{
+    return -ENOTSUP;
+}
+
+int rec_flush(void)
+{
+    return -ENOTSUP;
+}
+
+int rec_dump(void)
+{
+    return -ENOTSUP;
+}
+
+int rec_erase(void)
+{
+    return -ENOTSUP;
+}
+
+void rec_get_stats(struct rec_stats *stats)
+{
+    *stats = (struct rec_stats){0};
+}
+
+#endif /* REC_ENABLE */
@@ -0,0 +1,106 @@
+/**
+ * \file GMTrec.h
+ * 
+ * \brief Persistent snapshot recorder header
+ * 
+ * A low priority thread takes every RTDB snapshot (as an RTDB subscriber), packs it in a RAM
+ * chunk and appends each full chunk to a flash circular buffer (FCB) on the storage partition,
+ * erasing the oldest sector when the flash is full. Acquisition does not wait for the recorder,
+ * it only notifies it, but the nRF flash controller halts the CPU while it programs a word or
+ * erases a page: a chunk write stalls every thread for short steps, and a page erase (about 85 ms)
+ * would stall it at once. rec.conf therefore enables the partial erase, which splits an erase in
+ * slices of CONFIG_SOC_FLASH_NRF_PARTIAL_ERASE_MS, and the analog releases missed or skipped while
+ * a chunk is written are counted (an_missed). The recorder is built when the FCB is enabled, e.g.
+ * with -DEXTRA_CONF_FILE=rec.conf.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTREC_H_
+#define GMTREC_H_
+
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include "rtdb.h"
+
+#ifdef CONFIG_FCB
+#define REC_ENABLE 1
+#else
+#define REC_ENABLE 0 /**< Recorder built only with the FCB enabled (rec.conf) */
+#endif
+
+#define REC_MAGIC 0x53455452 /**< Identifies this recorder's FCB ("SETR") */
+#define REC_SECTORS_MAX 8 /**< Flash sectors used, at most, from the storage partition */
+#define REC_RECORD_BYTES (8 + 2 * NUM_CHANNELS) /**< Packed snapshot: seq, timestamp, raw value of each channel */
+#define REC_CHUNK_BYTES 4064 /**< Bytes of one flash write: a 4 KiB sector minus the FCB sector and entry headers */
+#define REC_CHUNK_RECORDS (REC_CHUNK_BYTES / REC_RECORD_BYTES) /**< Snapshots per chunk */
+
+/** Recorder figures */
+struct rec_stats {
+    uint32_t records;           /**< Snapshots recorded */
+    uint32_t dropped;           /**< Snapshots published while the recorder was busy (sequence gaps) */
+    uint32_t chunks;            /**< Chunks written */
+    uint32_t payload_bytes;     /**< Bytes of snapshots written */
+    uint32_t flash_bytes;       /**< Bytes programmed, FCB entry headers and alignment included */
+    uint32_t erases;            /**< Sectors erased to make room */
+    uint32_t erase_bytes;       /**< Bytes erased to make room */
+    uint32_t write_us;          /**< Time spent writing and erasing (in us) */
+    uint32_t an_missed;         /**< Analog releases missed or skipped while a chunk was written */
+};
+
+/** \brief Recorder init
+ * 
+ * Opens the FCB on the storage partition and subscribes to the RTDB. The partition is erased
+ * and formatted only if a sector header holds another magic than REC_MAGIC; the headers are
+ * logged first. Any other failure leaves the flash untouched.
+ * 
+ * \return 0 on success, -ENOTSUP without the FCB, negative error code on failure
+ */
+int rec_init(void);
+
+/** \brief Recorder collect
+ * 
+ * Waits for the next snapshot and adds it to the RAM chunk, writing the chunk to flash when full.
+ * Called in a loop by the recorder thread.
+ * 
+ * \param timeout Longest wait for a snapshot
+ * \return 0 on success, -EAGAIN on timeout, negative error code on a flash failure
+ */
+int rec_collect(k_timeout_t timeout);
+
+/** \brief Recorder flush
+ * 
+ * Writes the snapshots waiting in RAM as a (short) chunk.
+ * 
+ * \return 0 on success, negative error code on failure
+ */
+int rec_flush(void);
+
+/** \brief Recorder dump
+ * 
+ * Prints every recorded snapshot, oldest first, as $R,seq,timestamp,raw0,...,rawN& frames.
+ * The recorder keeps running meanwhile: the lock is only taken to fetch each record, and if the
+ * oldest sector is erased under the dump, it carries on with the oldest snapshot still recorded.
+ * 
+ * \return number of snapshots printed, negative error code on failure
+ */
+int rec_dump(void);
+
+/** \brief Recorder erase
+ * 
+ * Erases the recorded snapshots, in flash and in RAM
+ * 
+ * \return 0 on success, negative error code on failure
+ */
+int rec_erase(void);
+
+/** \brief Recorder stats
+ * 
+ * \param stats Destination
+ */
+void rec_get_stats(struct rec_stats *stats);
+
+#endif /* GMTREC_H_ */
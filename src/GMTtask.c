@@ -0,0 +1,383 @@
+/**
+ * \file GMTtask.c
+ * 
+ * \brief Periodic task engine code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/timing/timing.h>   /* for timing services */
+#include <zephyr/sys/printk.h>      /* for snprintk()*/
+#include "GMTtask.h"
+
+static struct ptask *ptask_list[PTASK_MAX];
+static int ptask_count;
+
+static uint32_t ptask_cycles_to_us(uint64_t cycles)
+{
+#ifdef CONFIG_SCHED_THREAD_USAGE
+    return (uint32_t)k_cyc_to_us_floor64(cycles);
+#else
+    return (uint32_t)(timing_cycles_to_ns(cycles) / 1000);
+#endif
+}
+
+#ifdef CONFIG_SCHED_THREAD_USAGE
+/* Cycles the current thread has run so far; a job's thread runs nothing else meanwhile */
+static uint64_t ptask_thread_cycles(void)
+{
+    k_thread_runtime_stats_t stats;
+
+    k_thread_runtime_stats_get(k_current_get(), &stats);
+    return stats.execution_cycles;
+}
+#endif
+
+void ptask_init(struct ptask *t, const char *name, int period_ms, enum ptask_overrun policy)
+{
+    *t = (struct ptask){0};
+    t->name = name;
+    t->period = period_ms;
+    t->policy = policy;
+    t->exec_min = UINT32_MAX;
+    if (ptask_count < PTASK_MAX) {
+        ptask_list[ptask_count++] = t;
+    }
+}
+
+void ptask_start(struct ptask *t)
+{
+    t->release = k_uptime_ticks();
+    t->start = t->release;
+    ptask_exec_begin(t);
+}
+
+void ptask_set_period(struct ptask *t, int period_ms)
+{
+    t->period = period_ms;
+}
+
+void ptask_exec_begin(struct ptask *t)
+{
+#ifdef CONFIG_SCHED_THREAD_USAGE
+    t->exec_start = ptask_thread_cycles();
+#else
+    t->exec_start = timing_counter_get();
+#endif
+}
+
+void ptask_exec_end(struct ptask *t)
+{
+#ifdef CONFIG_SCHED_THREAD_USAGE
+    uint32_t cycles = (uint32_t)(ptask_thread_cycles() - t->exec_start);
+#else
+    timing_t end = timing_counter_get();
+    uint32_t cycles = (uint32_t)timing_cycles_get(&t->exec_start, &end);
+#endif
+    uint32_t us = ptask_cycles_to_us(cycles);
+    int bucket = (us == 0) ? 0 : 32 - __builtin_clz(us);
+
+    t->exec_count++;
+    t->exec_min = MIN(t->exec_min, cycles);
+    t->exec_max = MAX(t->exec_max, cycles);
+    t->exec_sum += cycles;
+    t->exec_hist[MIN(bucket, PTASK_HIST_BUCKETS - 1)]++;
+}
+
+/* Counters of the job that just finished, released at t->release */
+static void ptask_job_count(struct ptask *t, int64_t now, int64_t period)
+{
+    uint32_t response = (uint32_t)k_ticks_to_us_floor64(now - t->release);
+
+    ptask_exec_end(t);
+    t->jobs++;
+    t->response_last = response;
+    t->response_max = MAX(t->response_max, response);
+    if (now > t->release + period) {
+        t->missed++;
+    }
+}
+
+k_timeout_t ptask_job_end(struct ptask *t)
+{
+    int64_t now = k_uptime_ticks();
+    int64_t period = MAX((int64_t)k_ms_to_ticks_ceil64(MAX(t->period, 0)), 1);
+    int64_t next;
+
+    ptask_job_count(t, now, period);
+
+    /* Next release on the grid, with the period requested by now */
+    next = t->release + period;
+    if (next <= now && t->policy != PTASK_CATCHUP) {
+        /* Overrun: n whole periods were missed */
+        int64_t n = (now - next) / period + 1;
+
+        if (t->policy == PTASK_SKIP) {
+            next += n * period;                 /* first release in the future */
+            t->skipped += n;
+        }
+        else {
+            next += (n - 1) * period;           /* latest missed release, run right away */
+            t->skipped += n - 1;
+        }
+    }
+    t->release = next;
+    return K_TIMEOUT_ABS_TICKS(next);
+}
+
+void ptask_job_begin(struct ptask *t)
+{
+    t->start = k_uptime_ticks();
+    t->jitter_last = (uint32_t)k_ticks_to_us_floor64(t->start - t->release);
+    t->jitter_max = MAX(t->jitter_max, t->jitter_last);
+    t->jitter_sum += t->jitter_last;
+    ptask_exec_begin(t);
+}
+
+void ptask_wait_next(struct ptask *t)
+{
+    k_sleep(ptask_job_end(t));
+    ptask_job_begin(t);
+}
+
+void ptask_event_end(struct ptask *t)
+{
+    ptask_job_count(t, k_uptime_ticks(), MAX((int64_t)k_ms_to_ticks_ceil64(MAX(t->period, 0)), 1));
+}
+
+void ptask_event_begin(struct ptask *t, int64_t release)
+{
+    t->release = release;
+    ptask_job_begin(t);
+}
+
+void ptask_set_release_src(struct ptask *t, const struct ptask *src)
+{
+    t->release_src = src;
+}
+
+int ptask_report(char *buf, size_t size)
+{
+    /* The last byte before the null is kept for the '&': a truncated report still ends its frame */
+    const int body = (int)size - 1;
+    int len = snprintk(buf, body, "$S");
+
+    for (int i = 0; i < ptask_count && len < body; i++) {
+        const struct ptask *t = ptask_list[i];
+        uint32_t n = MAX(t->exec_count, 1);
+
+        len += snprintk(&buf[len], body - len, ";%.*s,%u,%u,%u,%u,%u,%u,%u,%u,%u,",
+                        PTASK_NAME_MAX, t->name, t->jobs, t->missed, t->skipped,
+                        t->exec_count ? ptask_cycles_to_us(t->exec_min) : 0,
+                        ptask_cycles_to_us(t->exec_sum / n),
+                        ptask_cycles_to_us(t->exec_max),
+                        (uint32_t)(t->jitter_sum / MAX(t->jobs, 1)), t->jitter_max, t->response_max);
+        for (int b = 0; b < PTASK_HIST_BUCKETS && len < body; b++) {
+            len += snprintk(&buf[len], body - len, b ? "/%u" : "%u", t->exec_hist[b]);
+        }
+    }
+    len = MIN(len, body - 1);
+    buf[len++] = '&';
+    buf[len] = '\0';
+    return len;
+}
+
+void ptask_set_thread(struct ptask *t, k_tid_t thread)
+{
+    t->thread = thread;
+}
+
+/* Liu and Layland bound n(2^(1/n) - 1) in per mille, for n = 1..PTASK_MAX */
+static const uint16_t ptask_rm_bound[PTASK_MAX] = {1000, 828, 779, 756, 743, 734, 728, 724};
+
+/* Period of p (in us) in the test, period_ms[k] if p is t[k] */
+static uint32_t ptask_test_period(const struct ptask *p, struct ptask *const *t, const int *period_ms, int n_t)
+{
+    for (int j = 0; j < n_t; j++) {
+        if (t[j] == p) {
+            return (uint32_t)period_ms[j] * 1000;
+        }
+    }
+    return (uint32_t)p->period * 1000;
+}
+
+/* Schedulability test of the periodic tasks, with period_ms[k] for t[k], k < n */
+static bool ptask_feasible_n(struct ptask *const *t, const int *period_ms, int n_t)
+{
+    uint32_t period[PTASK_MAX], wcet[PTASK_MAX];
+    int prio[PTASK_MAX];
+    uint32_t util = 0;
+    int n = 0;
+
+    /* Periodic tasks sorted by period, i.e. by rate monotonic priority */
+    for (int i = 0; i < ptask_count; i++) {
+        const struct ptask *p = ptask_list[i];
+        uint32_t T = ptask_test_period(p, t, period_ms, n_t);
+        uint32_t C = ptask_cycles_to_us(p->exec_max) * (100 + PTASK_WCET_MARGIN) / 100;
+        /* Tasks with no thread of their own count as the highest priority */
+        int P = (p->thread != NULL) ? k_thread_priority_get(p->thread) : 0;
+        int j;
+
+        /* Released by another task's jobs too: as often as the source task when it is faster */
+        if (p->release_src != NULL && ptask_test_period(p->release_src, t, period_ms, n_t) != 0) {
+            T = MIN(T, ptask_test_period(p->release_src, t, period_ms, n_t));
+        }
+
+        if (T == 0) {
+            continue;           /* event driven, no period */
+        }
+        for (j = n++; j > 0 && period[j - 1] > T; j--) {
+            period[j] = period[j - 1];
+            wcet[j] = wcet[j - 1];
+            prio[j] = prio[j - 1];
+        }
+        period[j] = T;
+        wcet[j] = C;
+        prio[j] = P;
+        util += (uint32_t)((uint64_t)C * 1000 / T);
+    }
+    if (n == 0) {
+        return true;
+    }
+    if (util > 1000) {
+        return false;
+    }
+#if PTASK_RM_PRIORITIES
+    /* Priorities follow the periods, shortest first */
+    if (util <= ptask_rm_bound[n - 1]) {
+        return true;
+    }
+    for (int i = 0; i < n; i++) {
+        prio[i] = i;
+    }
+#endif
+
+    /* Response time analysis: R = C_i + B_i + sum over higher priorities of ceil(R / T_j) * C_j.
+     * Threads of equal priority run in FIFO order without time slicing: a job waits for at most
+     * one job of each of them, B_i. */
+    for (int i = 0; i < n; i++) {
+        uint64_t b = 0, r, prev = 0;
+
+        for (int j = 0; j < n; j++) {
+            if (j != i && prio[j] == prio[i]) {
+                b += wcet[j];
+            }
+        }
+        r = wcet[i] + b;
+        while (r != prev && r <= period[i]) {
+            prev = r;
+            r = wcet[i] + b;
+            for (int j = 0; j < n; j++) {
+                if (prio[j] < prio[i]) {
+                    r += (prev + period[j] - 1) / period[j] * wcet[j];
+                }
+            }
+        }
+        if (r > period[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Schedulability test of the periodic tasks, with period_ms for t */
+static bool ptask_feasible(struct ptask *t, int period_ms)
+{
+    return ptask_feasible_n(&t, &period_ms, 1);
+}
+
+#if PTASK_RM_PRIORITIES
+/* Thread priorities by period, shortest first */
+static void ptask_rm_assign(void)
+{
+    for (int i = 0; i < ptask_count; i++) {
+        const struct ptask *p = ptask_list[i];
+        int prio = PTASK_RM_PRIO_BASE;
+
+        if (p->thread == NULL || p->period <= 0) {
+            continue;
+        }
+        for (int j = 0; j < ptask_count; j++) {
+            const struct ptask *q = ptask_list[j];
+
+            if (q->thread != NULL && q->period > 0 &&
+                (q->period < p->period || (q->period == p->period && j < i))) {
+                prio++;
+            }
+        }
+        k_thread_priority_set(p->thread, prio);
+    }
+}
+#endif
+
+int ptask_admissible(struct ptask *t, int period_ms)
+{
+    if (period_ms < 1 || period_ms > PTASK_PERIOD_MAX) {
+        return -EINVAL;
+    }
+    if (!ptask_feasible(t, period_ms)) {
+#if PTASK_ADMIT_CLAMP
+        /* Shortest feasible period above the requested one */
+        int lo = period_ms, hi = PTASK_PERIOD_MAX;
+
+        if (!ptask_feasible(t, hi)) {
+            return -EBUSY;
+        }
+        while (hi - lo > 1) {
+            int mid = lo + (hi - lo) / 2;
+
+            if (ptask_feasible(t, mid)) {
+                hi = mid;
+            }
+            else {
+                lo = mid;
+            }
+        }
+        period_ms = hi;
+#else
+        return -EBUSY;
+#endif
+    }
+    return period_ms;
+}
+
+int ptask_admit(struct ptask *t, int period_ms)
+{
+    period_ms = ptask_admissible(t, period_ms);
+    if (period_ms < 0) {
+        return period_ms;
+    }
+    ptask_set_period(t, period_ms);
+#if PTASK_RM_PRIORITIES
+    ptask_rm_assign();
+#endif
+    return period_ms;
+}
+
+int ptask_admissible_n(struct ptask *const *t, const int *period_ms, int n)
+{
+    for (int k = 0; k < n; k++) {
+        if (period_ms[k] < 1 || period_ms[k] > PTASK_PERIOD_MAX) {
+            return -EINVAL;
+        }
+    }
+    if (!ptask_feasible_n(t, period_ms, n)) {
+        return -EBUSY;
+    }
+    return 0;
+}
+
+void ptask_set_periods(struct ptask *const *t, const int *period_ms, int n)
+{
+    for (int k = 0; k < n; k++) {
+        ptask_set_period(t[k], period_ms[k]);
+    }
+#if PTASK_RM_PRIORITIES
+    ptask_rm_assign();
+#endif
+}
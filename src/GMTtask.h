@@ -0,0 +1,255 @@
+/**
+ * \file GMTtask.h
+ * 
+ * \brief Periodic task engine header
+ * 
+ * Releases are kept on an absolute time grid (no drift), period changes are applied at
+ * the next release and overruns are handled by a per-task policy.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTTASK_H_
+#define GMTTASK_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/timing/timing.h>   /* for timing services */
+#include <stddef.h>
+#include <stdint.h>
+
+#define PTASK_MAX 8 /**< Maximum number of tasks known to the engine */
+#define PTASK_HIST_BUCKETS 16 /**< Execution time histogram: bucket i holds times in [2^(i-1), 2^i) us */
+#define PTASK_NAME_MAX 16 /**< Longest task name written by ptask_report(), longer ones are cut */
+/** Longest ptask_report() frame, with its terminating null: per task ';', the name, then 9 counters
+ * and PTASK_HIST_BUCKETS buckets of up to 10 digits, each followed by a separator */
+#define PTASK_REPORT_SIZE (sizeof("$S&") + PTASK_MAX * (1 + PTASK_NAME_MAX + 1 + (9 + PTASK_HIST_BUCKETS) * 11))
+
+/* Admission control of period changes (see ptask_admit()) */
+#define PTASK_PERIOD_MAX 9999 /**< Longest period that can be requested (in ms) */
+#define PTASK_WCET_MARGIN 20 /**< Margin added to the measured worst execution time (in %) */
+#define PTASK_ADMIT_CLAMP 1 /**< 1: an infeasible period is raised to the shortest feasible one, 0: rejected */
+#define PTASK_RM_PRIORITIES 0 /**< 1: thread priorities are reassigned by period (rate monotonic) on every change */
+#define PTASK_RM_PRIO_BASE 1 /**< Priority of the task with the shortest period when PTASK_RM_PRIORITIES is 1 */
+
+/** What to do with releases missed because a job finished after its next release */
+enum ptask_overrun {
+    PTASK_SKIP,         /**< Drop the missed releases and wait for the next one on the grid */
+    PTASK_CATCHUP,      /**< Run one job per missed release, back to back, until on time again */
+    PTASK_COMPRESS,     /**< Merge the missed releases into a single job run immediately */
+};
+
+/** Periodic task: release grid, period and counters */
+struct ptask {
+    const char *name;
+    volatile int period;        /**< Requested period (in ms), applied at the next release */
+    enum ptask_overrun policy;
+    int64_t release;            /**< Nominal release of the current job (in ticks) */
+    int64_t start;              /**< Actual start of the current job (in ticks) */
+    k_tid_t thread;             /**< Thread running the jobs, NULL if not set */
+    const struct ptask *release_src; /**< Task whose jobs may also release this one, NULL if none */
+
+    /* Counters */
+    uint32_t jobs;              /**< Completed jobs */
+    uint32_t missed;            /**< Jobs that completed after their deadline (one period after release) */
+    uint32_t skipped;           /**< Releases dropped by PTASK_SKIP or PTASK_COMPRESS */
+    uint32_t response_last;     /**< Response time of the last job, release to completion (in us) */
+    uint32_t response_max;      /**< Worst response time (in us) */
+    uint32_t jitter_last;       /**< Release jitter of the last job, release to start (in us) */
+    uint32_t jitter_max;        /**< Worst release jitter (in us) */
+
+    /* Execution time: CPU time of the job's own thread with CONFIG_SCHED_THREAD_USAGE (preemption
+     * excluded), otherwise wall time from the timing counter (preemption included) */
+#ifdef CONFIG_SCHED_THREAD_USAGE
+    uint64_t exec_start;        /**< Cycles run by the job's thread when the job started */
+#else
+    timing_t exec_start;
+#endif
+    uint32_t exec_count;        /**< Measured jobs */
+    uint32_t exec_min;          /**< Shortest execution time (in cycles) */
+    uint32_t exec_max;          /**< Longest execution time (in cycles) */
+    uint64_t exec_sum;          /**< Sum of the execution times (in cycles), for the mean */
+    uint64_t jitter_sum;        /**< Sum of the release jitters (in us), for the mean */
+    uint32_t exec_hist[PTASK_HIST_BUCKETS]; /**< log2 histogram of the execution times (in us) */
+};
+
+/** \brief Periodic task init
+ * 
+ * Also registers the task for ptask_report().
+ * 
+ * \param t Task
+ * \param name Name used in reports
+ * \param period_ms Initial period (in ms)
+ * \param policy Overrun policy
+ */
+void ptask_init(struct ptask *t, const char *name, int period_ms, enum ptask_overrun policy);
+
+/** \brief Periodic task start
+ * 
+ * Releases the first job now. Called once, by the task itself, before its first job.
+ * 
+ * \param t Task
+ */
+void ptask_start(struct ptask *t);
+
+/** \brief Periodic task set period
+ * 
+ * Requests a new period; it is used to compute the release after the current one.
+ * 
+ * \param t Task
+ * \param period_ms New period (in ms)
+ */
+void ptask_set_period(struct ptask *t, int period_ms);
+
+/** \brief Periodic task admit
+ * 
+ * Admission control of a period change: the periodic tasks, with their measured worst execution
+ * time plus PTASK_WCET_MARGIN and the requested period for t, must pass a response time analysis
+ * with deadline = period. With PTASK_RM_PRIORITIES 1 it is the rate monotonic test (utilisation
+ * bound first); with 0 it uses the priorities the threads actually run at, each job also waiting for
+ * one job of every task of equal priority (FIFO, no time slicing).
+ * An infeasible period is clamped or rejected according to PTASK_ADMIT_CLAMP.
+ * 
+ * \param t Task
+ * \param period_ms Requested period (in ms), 1..PTASK_PERIOD_MAX
+ * \return the admitted period (in ms), -EINVAL if out of range, -EBUSY if no feasible period
+ */
+int ptask_admit(struct ptask *t, int period_ms);
+
+/** \brief Periodic task admissible
+ * 
+ * Runs the test of ptask_admit() without changing the period.
+ * 
+ * \param t Task
+ * \param period_ms Requested period (in ms)
+ * \return the period ptask_admit() would apply (in ms), or its negative error code
+ */
+int ptask_admissible(struct ptask *t, int period_ms);
+
+/** \brief Periodic task admissible n
+ * 
+ * Runs the test of ptask_admit() with the requested periods of several tasks at once.
+ * Nothing is clamped: either the whole set is feasible or it is rejected.
+ * 
+ * \param t Tasks
+ * \param period_ms Requested period of each task (in ms)
+ * \param n Number of tasks
+ * \return 0 if feasible, -EINVAL if a period is out of range, -EBUSY if not feasible
+ */
+int ptask_admissible_n(struct ptask *const *t, const int *period_ms, int n);
+
+/** \brief Periodic task set periods
+ * 
+ * Sets the periods of several tasks, normally after ptask_admissible_n(), and reassigns
+ * the priorities when PTASK_RM_PRIORITIES is 1.
+ * 
+ * \param t Tasks
+ * \param period_ms Period of each task (in ms)
+ * \param n Number of tasks
+ */
+void ptask_set_periods(struct ptask *const *t, const int *period_ms, int n);
+
+/** \brief Periodic task set thread
+ * 
+ * Records the thread running the jobs of t, whose priority PTASK_RM_PRIORITIES may reassign.
+ * 
+ * \param t Task
+ * \param thread Thread
+ */
+void ptask_set_thread(struct ptask *t, k_tid_t thread);
+
+/** \brief Periodic task job end
+ * 
+ * Updates the counters of the job that just finished and computes the next release
+ * according to the period and the overrun policy.
+ * 
+ * \param t Task
+ * \return absolute timeout of the next release
+ */
+k_timeout_t ptask_job_end(struct ptask *t);
+
+/** \brief Periodic task job begin
+ * 
+ * Records the start of a job and its release jitter.
+ * 
+ * \param t Task
+ */
+void ptask_job_begin(struct ptask *t);
+
+/** \brief Periodic task exec begin
+ * 
+ * Starts measuring the execution time of a job, on the thread running it. Called by
+ * ptask_job_begin(); event driven tasks, which have no release grid, call it directly.
+ * 
+ * \param t Task
+ */
+void ptask_exec_begin(struct ptask *t);
+
+/** \brief Periodic task exec end
+ * 
+ * Stops measuring the execution time of a job and updates min, max, mean and histogram.
+ * Called by ptask_job_end(); event driven tasks call it directly.
+ * 
+ * \param t Task
+ */
+void ptask_exec_end(struct ptask *t);
+
+/** \brief Periodic task report
+ * 
+ * Writes the counters of every registered task as one frame:
+ * $S;name,jobs,missed,skipped,exec_min,exec_mean,exec_max,jitter_mean,jitter_max,response_max,h0/h1/.../h15;...&
+ * with all times in us. exec_* and the histogram are the CPU time of the job's thread when
+ * CONFIG_SCHED_THREAD_USAGE is enabled; without it they are wall time, preemption included,
+ * and read as response time from the start of the job.
+ * 
+ * PTASK_REPORT_SIZE holds the longest frame. A smaller destination truncates the counters, but
+ * the frame always ends with '&'.
+ * 
+ * \param buf Destination
+ * \param size Size of the destination, at least 2
+ * \return length of the frame, truncated to fit
+ */
+int ptask_report(char *buf, size_t size);
+
+/** \brief Periodic task wait next
+ * 
+ * Ends the current job, sleeps until the next release and begins the next job.
+ * 
+ * \param t Task
+ */
+void ptask_wait_next(struct ptask *t);
+
+/** \brief Periodic task event end
+ * 
+ * Ends a job like ptask_job_end() (jobs, response time, missed deadline one period after the
+ * release, execution time) without computing a next release: the next job is released by an
+ * event, see ptask_event_begin().
+ * 
+ * \param t Task
+ */
+void ptask_event_end(struct ptask *t);
+
+/** \brief Periodic task event begin
+ * 
+ * Begins a job released by an event at release instead of by the grid; the release jitter is
+ * the time from the event to the start of the job.
+ * 
+ * \param t Task
+ * \param release Time of the event (in ticks)
+ */
+void ptask_event_begin(struct ptask *t, int64_t release);
+
+/** \brief Periodic task set release source
+ * 
+ * Declares that the jobs of src may release jobs of t (e.g. a new snapshot of the analog task
+ * notifying the PWM task), at most one per job of src. The schedulability test then takes the
+ * shorter of the two periods for t.
+ * 
+ * \param t Task
+ * \param src Releasing task, NULL when t only runs on its own grid
+ */
+void ptask_set_release_src(struct ptask *t, const struct ptask *src);
+
+#endif /* GMTTASK_H_ */
@@ -0,0 +1,323 @@
+/**
+ * \file GMTtelem.c
+ * 
+ * \brief Binary telemetry code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/uart.h>    /* for UART*/
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include "GMTtelem.h"
+
+static const struct device *telem_uart;
+static uint8_t telem_buf[2][TELEM_FRAME_SIZE];
+static int telem_fill;              /**< Buffer being filled */
+static int telem_count;             /**< Snapshots in the buffer being filled */
+static uint16_t telem_seq;          /**< Sequence number of the next frame */
+static atomic_t telem_busy[2];      /**< Buffer queued or on the wire */
+static atomic_t telem_drops;
+
+/* History frames: header and CRC of each channel's frame; the samples stay in the ring */
+BUILD_ASSERT(sizeof(struct adc_ts_sample) == 8, "history samples are sent as laid out in memory");
+
+/** History frame of a channel, sent in parts: header, samples before the ring wraps, after it, CRC */
+struct telem_hist {
+    uint8_t header[TELEM_HIST_HEADER_SIZE];
+    uint8_t crc[2];
+    uint32_t first;             /**< Sequence number of the first sample */
+    uint32_t n;                 /**< Number of samples */
+    int part;                   /**< Next part to send, TELEM_HIST_PARTS when done */
+    atomic_t busy;              /**< Queued or on the wire */
+};
+
+#define TELEM_HIST_PARTS 4
+
+static struct telem_hist telem_hist[NUM_CHANNELS];
+static uint32_t telem_baud = TELEM_BAUD_DEFAULT;
+
+/** Frame waiting for the UART: one buffer, or the parts of a history frame */
+struct telem_seg {
+    const uint8_t *buf;
+    size_t len;
+    atomic_t *release;          /**< Cleared once the whole frame has been sent or dropped */
+    int hist;                   /**< Channel of a history frame, -1 for a buffer */
+};
+
+/* Transmit queue: filled by the threads, emptied from the UART callback */
+static struct telem_seg telem_q[TELEM_TX_QUEUE];
+static uint32_t telem_q_head;       /**< Frame on the wire, or next to send */
+static uint32_t telem_q_tail;       /**< Next free entry */
+static bool telem_q_active;         /**< A part of telem_q[telem_q_head] is on the wire */
+static struct k_spinlock telem_q_lock;
+
+/* Samples the acquisition may push into a ring while a history frame of n samples is sent:
+ * the frame's time on the wire over the channel's current sample interval, plus one burst */
+static uint32_t telem_hist_guard(const struct adc_sample_ring *ring, uint32_t n)
+{
+    const uint32_t count = ring->count;
+    const uint32_t bytes = TELEM_HIST_HEADER_SIZE + n * sizeof(struct adc_ts_sample) + 2;
+    const uint64_t tx_us = (uint64_t)bytes * 10 * USEC_PER_SEC / telem_baud;   /* 10 bits per byte */
+    const uint32_t burst = adc_hr_period() ? ADC_HR_BLOCK : ADC_STREAMING ? ADC_STREAM_BLOCK : ADC_OVERSAMPLE;
+    uint32_t interval = 1;
+
+    if (count >= 2) {
+        interval = ring->samples[(count - 1) % MEM_SIZE].timestamp - ring->samples[(count - 2) % MEM_SIZE].timestamp;
+        interval = MAX(interval, 1);
+    }
+    return (uint32_t)(tx_us / interval) + 1 + burst;
+}
+
+/* Header and CRC of a history frame, from the samples in the ring */
+static void telem_hist_build(struct telem_hist *h, int ch)
+{
+    const struct adc_sample_ring *ring = &adc_channel_rings[ch];
+    const uint32_t idx = h->first % MEM_SIZE;
+    const uint32_t wrap = MIN(h->n, MEM_SIZE - idx);   /* samples before the ring wraps */
+    uint16_t crc;
+
+    h->header[0] = TELEM_SYNC0;
+    h->header[1] = TELEM_SYNC1;
+    h->header[2] = TELEM_TYPE_HIST;
+    h->header[3] = (uint8_t)ch;
+    sys_put_le16((uint16_t)h->n, &h->header[4]);
+    sys_put_le32(h->first, &h->header[6]);
+    crc = crc16_ccitt(0xFFFF, &h->header[2], TELEM_HIST_HEADER_SIZE - 2);
+    crc = crc16_ccitt(crc, (const uint8_t *)&ring->samples[idx], wrap * sizeof(struct adc_ts_sample));
+    crc = crc16_ccitt(crc, (const uint8_t *)&ring->samples[0], (h->n - wrap) * sizeof(struct adc_ts_sample));
+    sys_put_le16(crc, h->crc);
+}
+
+/* Drops the oldest samples of a history frame that the acquisition could overwrite before the
+ * frame is through, keeping its newest ones; true if it was trimmed (header and CRC are stale) */
+static bool telem_hist_trim(struct telem_hist *h, int ch)
+{
+    const struct adc_sample_ring *ring = &adc_channel_rings[ch];
+    const uint32_t end = h->first + h->n;
+    const uint32_t guard = telem_hist_guard(ring, h->n);
+
+    if (ring->count - h->first + guard <= MEM_SIZE) {
+        return false;
+    }
+    h->first = MIN(ring->count + guard - MEM_SIZE, end);
+    h->n = end - h->first;
+    return true;
+}
+
+/* Next part of a history frame; -ESTALE if its samples are no longer in the ring */
+static int telem_hist_part(int ch, const uint8_t **buf, size_t *len)
+{
+    struct telem_hist *h = &telem_hist[ch];
+    const struct adc_sample_ring *ring = &adc_channel_rings[ch];
+    uint32_t idx, wrap;
+
+    if (h->part == 0 && telem_hist_trim(h, ch)) {
+        /* Waited in the queue long enough for its oldest samples to be at risk */
+        telem_hist_build(h, ch);
+    }
+    idx = h->first % MEM_SIZE;
+    wrap = MIN(h->n, MEM_SIZE - idx);
+    switch (h->part++) {
+    case 0:
+        *buf = h->header;
+        *len = TELEM_HIST_HEADER_SIZE;
+        return 0;
+    case 1:
+        *buf = (const uint8_t *)&ring->samples[idx];
+        *len = wrap * sizeof(struct adc_ts_sample);
+        break;
+    case 2:
+        *buf = (const uint8_t *)&ring->samples[0];
+        *len = (h->n - wrap) * sizeof(struct adc_ts_sample);
+        break;
+    default:
+        *buf = h->crc;
+        *len = 2;
+        return 0;
+    }
+    /* The guard of telem_hist_trim() covers the whole frame, this only catches a wrong guess */
+    if (ring->count - h->first > MEM_SIZE) {
+        return -ESTALE;
+    }
+    return 0;
+}
+
+/* Drops the frame at the head of the queue, all its parts together; lock held */
+static void telem_q_drop(void)
+{
+    const struct telem_seg *seg = &telem_q[telem_q_head % TELEM_TX_QUEUE];
+
+    if (seg->release != NULL) {
+        atomic_clear(seg->release);
+    }
+    atomic_inc(&telem_drops);
+    telem_q_head++;
+}
+
+/* Starts the next part on the wire if the UART is idle; lock held */
+static void telem_q_kick(void)
+{
+    while (!telem_q_active && telem_q_head != telem_q_tail) {
+        const struct telem_seg *seg = &telem_q[telem_q_head % TELEM_TX_QUEUE];
+        const uint8_t *buf = seg->buf;
+        size_t len = seg->len;
+        int ret = 0;
+
+        if (seg->hist >= 0) {
+            /* Empty parts (no wrap, no samples) are skipped */
+            do {
+                ret = telem_hist_part(seg->hist, &buf, &len);
+            } while (ret == 0 && len == 0);
+        }
+        if (ret == 0 && uart_tx(telem_uart, buf, len, SYS_FOREVER_MS) == 0) {
+            telem_q_active = true;
+            break;
+        }
+        /* Not sent: the rest of the frame goes too, so no headless frame reaches the wire */
+        telem_q_drop();
+    }
+}
+
+/* Queues a frame */
+static int telem_tx(const struct telem_seg *seg)
+{
+    k_spinlock_key_t key = k_spin_lock(&telem_q_lock);
+
+    if (telem_q_tail - telem_q_head >= TELEM_TX_QUEUE) {
+        k_spin_unlock(&telem_q_lock, key);
+        return -ENOBUFS;
+    }
+    telem_q[telem_q_tail++ % TELEM_TX_QUEUE] = *seg;
+    telem_q_kick();
+    k_spin_unlock(&telem_q_lock, key);
+    return 0;
+}
+
+void telem_init(const struct device *dev)
+{
+    struct uart_config cfg;
+
+    telem_uart = dev;
+    if (uart_config_get(dev, &cfg) == 0 && cfg.baudrate != 0) {
+        telem_baud = cfg.baudrate;
+    }
+    telem_fill = 0;
+    telem_count = 0;
+    telem_seq = 0;
+    atomic_set(&telem_busy[0], 0);
+    atomic_set(&telem_busy[1], 0);
+    atomic_set(&telem_drops, 0);
+}
+
+void telem_push(const struct adc_value_container *snapshot)
+{
+    uint8_t *frame = telem_buf[telem_fill];
+    uint8_t *p = &frame[TELEM_HEADER_SIZE + telem_count * TELEM_RECORD_SIZE];
+
+    sys_put_le32(snapshot->seq, p);
+    sys_put_le32(snapshot->timestamp, p + 4);
+    p += 8;
+    for (int i = 0; i < NUM_CHANNELS; i++, p += 2) {
+        sys_put_le16(snapshot->original_values[i], p);
+    }
+    for (int i = 0; i < NUM_CHANNELS; i++, p += 2) {
+        sys_put_le16(snapshot->converted_values[i], p);
+    }
+    if (++telem_count < TELEM_BATCH) {
+        return;
+    }
+
+    /* Close the frame */
+    frame[0] = TELEM_SYNC0;
+    frame[1] = TELEM_SYNC1;
+    frame[2] = TELEM_TYPE_ADC;
+    frame[3] = TELEM_BATCH;
+    sys_put_le16(telem_seq++, &frame[4]);
+    sys_put_le16(crc16_ccitt(0xFFFF, &frame[2], p - &frame[2]), p);
+    telem_count = 0;
+
+    /* Send it, unless the other buffer is still waiting or on the wire (it is filled next) */
+    if (atomic_get(&telem_busy[telem_fill ^ 1])) {
+        atomic_inc(&telem_drops);
+        return;
+    }
+    atomic_set(&telem_busy[telem_fill], 1);
+    const struct telem_seg seg = {.buf = frame, .len = TELEM_FRAME_SIZE, .release = &telem_busy[telem_fill], .hist = -1};
+
+    if (telem_tx(&seg) != 0) {
+        atomic_clear(&telem_busy[telem_fill]);
+        atomic_inc(&telem_drops);
+        return;
+    }
+    telem_fill ^= 1;
+}
+
+int telem_history(int ch, uint32_t since, uint32_t max)
+{
+    const struct adc_sample_ring *ring;
+    struct telem_hist *h;
+    uint32_t count, first;
+    int ret;
+
+    if (ch < 0 || ch >= NUM_CHANNELS) {
+        return -EINVAL;
+    }
+    h = &telem_hist[ch];
+    if (!atomic_cas(&h->busy, 0, 1)) {
+        return -EBUSY;
+    }
+    ring = &adc_channel_rings[ch];
+
+    /* Range: seq >= since, still in the ring, at most max newest, then trimmed to what stays
+     * valid while it is sent; trimmed again if it waits in the queue */
+    count = ring->count;
+    first = MAX(since, (count > MEM_SIZE) ? count - MEM_SIZE : 0);
+    first = MAX(first, (count > max) ? count - max : 0);
+    h->n = (first < count) ? count - first : 0;
+    h->first = count - h->n;
+    h->part = 0;
+    telem_hist_trim(h, ch);
+    telem_hist_build(h, ch);
+
+    const struct telem_seg seg = {.release = &h->busy, .hist = ch};
+
+    ret = telem_tx(&seg);
+    if (ret) {
+        atomic_clear(&h->busy);
+        return ret;
+    }
+    return h->n;
+}
+
+void telem_tx_done(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&telem_q_lock);
+
+    /* A transfer not started from the queue (e.g. at startup) is ignored */
+    if (telem_q_active) {
+        const struct telem_seg *seg = &telem_q[telem_q_head % TELEM_TX_QUEUE];
+
+        /* The frame is done after its last part */
+        if (seg->hist < 0 || telem_hist[seg->hist].part >= TELEM_HIST_PARTS) {
+            if (seg->release != NULL) {
+                atomic_clear(seg->release);
+            }
+            telem_q_head++;
+        }
+        telem_q_active = false;
+        telem_q_kick();
+    }
+    k_spin_unlock(&telem_q_lock, key);
+}
+
+uint32_t telem_dropped(void)
+{
+    return atomic_get(&telem_drops);
+}
@@ -0,0 +1,105 @@
+/**
+ * \file GMTtelem.h
+ * 
+ * \brief Binary telemetry header
+ * 
+ * RTDB snapshots are packed into CRC protected frames, several cycles per frame, and sent
+ * with uart_tx() from two alternating buffers on their own UART (TELEM_UART_NODE), apart from the
+ * console, the commands and their text replies. All fields are little endian:
+ * 
+ *   sync (0xA5 0x5A) | type (1) | count (1) | frame seq (2) | count x record | CRC-16/CCITT (2)
+ *   record: snapshot seq (4) | timestamp in us (4) | NUM_CHANNELS x raw (2) | NUM_CHANNELS x mV (2)
+ * 
+ * The CRC (seed 0xFFFF) covers everything from type to the last record.
+ * 
+ * History frames (telem_history()) answer a query with samples of one channel, sent straight
+ * from the RTDB ring without being copied:
+ * 
+ *   sync (0xA5 0x5A) | type (2) | channel (1) | count (2) | first sample seq (4) | count x sample | CRC-16/CCITT (2)
+ *   sample: struct adc_ts_sample as in memory: timestamp in us (4) | raw (2) | mV (2)
+ * 
+ * A history frame only carries samples that the acquisition cannot overwrite before the frame is
+ * through: the guard is the frame's time on the wire over the channel's current sample interval.
+ * It is trimmed (oldest samples first) when queued and again when it reaches the UART, after
+ * waiting behind other frames; the first sample seq tells the host where the data starts.
+ * All frames share one transmit queue, so frames are never interleaved on the wire, and a frame
+ * that cannot be sent is dropped as a whole.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTTELEM_H_
+#define GMTTELEM_H_
+
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <stdint.h>
+#include "rtdb.h"
+
+#define TELEM_ENABLE 1 /**< 1: stream binary telemetry, 0: no telemetry */
+#define TELEM_TEXT_DEBUG 0 /**< 1: also print the readings as text (debug only, slow) */
+#define TELEM_TEXT (TELEM_TEXT_DEBUG || !TELEM_ENABLE) /**< Text output of the readings and periods is enabled */
+#define TELEM_BATCH 8 /**< Number of snapshots per frame */
+#define TELEM_UART_NODE DT_NODELABEL(uart1) /**< UART of the telemetry; uart0 carries the console and commands */
+
+#define TELEM_SYNC0 0xA5 /**< First sync byte */
+#define TELEM_SYNC1 0x5A /**< Second sync byte */
+#define TELEM_TYPE_ADC 0x01 /**< Frame type of ADC snapshots */
+#define TELEM_TYPE_HIST 0x02 /**< Frame type of channel history */
+
+#define TELEM_HEADER_SIZE 6 /**< sync, type, count and frame seq */
+#define TELEM_RECORD_SIZE (8 + 4 * NUM_CHANNELS) /**< seq, timestamp, raw and mV values */
+#define TELEM_FRAME_SIZE (TELEM_HEADER_SIZE + TELEM_BATCH * TELEM_RECORD_SIZE + 2) /**< Full frame, with CRC */
+#define TELEM_HIST_HEADER_SIZE 10 /**< sync, type, channel, count and first sample seq */
+#define TELEM_TX_QUEUE 16 /**< Frames waiting for the UART, of every kind */
+#define TELEM_BAUD_DEFAULT 115200 /**< Baud rate assumed by the history guard if the UART does not report it */
+
+/** \brief Telemetry init
+ * 
+ * \param dev UART used to send the frames; its callback must call telem_tx_done()
+ */
+void telem_init(const struct device *dev);
+
+/** \brief Telemetry push
+ * 
+ * Adds a snapshot to the frame being filled. When the frame holds TELEM_BATCH snapshots it is
+ * closed and sent, and the other buffer starts being filled. If the previous frame is still
+ * being sent, the closed frame is dropped and counted.
+ * 
+ * \param snapshot Snapshot to add
+ */
+void telem_push(const struct adc_value_container *snapshot);
+
+/** \brief Telemetry history
+ * 
+ * Queues a history frame with the samples of a channel whose sequence number (position in the
+ * channel's ring, see struct adc_sample_ring) is at least since, at most max of the newest ones.
+ * Samples older than the ring, or that the acquisition could overwrite before the frame is sent,
+ * are left out: the first sample seq of the frame tells the host where the data starts.
+ * Returns without waiting for the UART.
+ * 
+ * \param ch Channel index
+ * \param since First sample seq wanted
+ * \param max Largest number of samples
+ * \return number of samples queued (fewer are sent if the frame has to be trimmed while it waits), -EINVAL for an invalid channel, -EBUSY if the previous
+ * history frame of the channel is still queued, -ENOBUFS if the transmit queue is full
+ */
+int telem_history(int ch, uint32_t since, uint32_t max);
+
+/** \brief Telemetry TX done
+ * 
+ * Releases the buffer that was being sent and starts the next one. Called from the UART callback on UART_TX_DONE.
+ * 
+ */
+void telem_tx_done(void);
+
+/** \brief Telemetry dropped
+ * 
+ * \return number of frames dropped because the UART was still busy or could not start them
+ */
+uint32_t telem_dropped(void);
+
+#endif /* GMTTELEM_H_ */
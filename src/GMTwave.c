@@ -0,0 +1,147 @@
+/**
+ * \file GMTwave.c
+ * 
+ * \brief PWM waveform playback code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include "GMTwave.h"
+#include "GMTpwm.h"
+
+/* Quarter of a sine period, 500 * sin(pi/2 * i/64) */
+static const uint16_t wave_sine_q[65] = {
+    0, 12, 25, 37, 49, 61, 73, 85, 98, 110, 121, 133, 145, 157, 168, 180,
+    191, 203, 214, 225, 236, 246, 257, 267, 278, 288, 298, 308, 317, 327, 336, 345,
+    354, 362, 370, 379, 387, 394, 402, 409, 416, 422, 429, 435, 441, 447, 452, 457,
+    462, 466, 471, 475, 478, 482, 485, 488, 490, 493, 495, 496, 498, 499, 499, 500,
+    500,
+};
+
+static uint16_t wave_table[WAVE_TABLE_MAX]; /**< Duty cycles (per mille) */
+static volatile int wave_len = 1;
+static int wave_idx;                        /**< Next entry, only used by the timer callback */
+static volatile bool wave_on;
+static atomic_t wave_duty;                  /**< Entry of the last step, written by wave_write() */
+
+static void wave_step(struct k_timer *timer);
+static void wave_write(struct k_work *work);
+static K_TIMER_DEFINE(wave_timer, wave_step, NULL);
+static K_WORK_DEFINE(wave_work, wave_write);
+
+/* Timer callback (ISR): picks the entry of this step and hands the write over */
+static void wave_step(struct k_timer *timer)
+{
+    atomic_set(&wave_duty, wave_table[wave_idx]);
+    if (++wave_idx >= wave_len) {
+        wave_idx = 0;
+    }
+    k_work_submit(&wave_work);
+}
+
+/* Work item (system work queue): the PWM driver and the bank are only used from threads.
+ * If it runs late, the steps in between are merged into the latest one. */
+static void wave_write(struct k_work *work)
+{
+    if (wave_on) {
+        pwm_set_duty(atomic_get(&wave_duty));
+    }
+}
+
+int wave_load_ramp(int len)
+{
+    if (len < 2 || len > WAVE_TABLE_MAX) {
+        return -EINVAL;
+    }
+    for (int i = 0; i < len; i++) {
+        wave_table[i] = (uint16_t)(i * 1000 / (len - 1));
+    }
+    wave_len = len;
+    return 0;
+}
+
+int wave_load_sine(int len)
+{
+    if (len < 2 || len > WAVE_TABLE_MAX) {
+        return -EINVAL;
+    }
+    for (int i = 0; i < len; i++) {
+        int phase = i * 256 / len;          /* 0..255, 64 per quadrant */
+        int q = phase & 63;
+
+        switch (phase >> 6) {
+        case 0:
+            wave_table[i] = 500 + wave_sine_q[q];
+            break;
+        case 1:
+            wave_table[i] = 500 + wave_sine_q[64 - q];
+            break;
+        case 2:
+            wave_table[i] = 500 - wave_sine_q[q];
+            break;
+        default:
+            wave_table[i] = 500 - wave_sine_q[64 - q];
+            break;
+        }
+    }
+    wave_len = len;
+    return 0;
+}
+
+int wave_set(int idx, const uint16_t *values, int n)
+{
+    if (idx < 0 || n < 0 || idx + n > WAVE_TABLE_MAX) {
+        return -EINVAL;
+    }
+    for (int i = 0; i < n; i++) {
+        if (values[i] > 1000) {
+            return -EINVAL;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        wave_table[idx + i] = values[i];
+    }
+    return 0;
+}
+
+int wave_set_length(int len)
+{
+    if (len < 1 || len > WAVE_TABLE_MAX) {
+        return -EINVAL;
+    }
+    wave_len = len;
+    return 0;
+}
+
+int wave_start(uint32_t step_us)
+{
+    if (step_us < WAVE_STEP_MIN_US) {
+        return -EINVAL;
+    }
+    k_timer_stop(&wave_timer);
+    wave_idx = 0;
+    wave_on = true;
+    k_timer_start(&wave_timer, K_NO_WAIT, K_USEC(step_us));
+    return 0;
+}
+
+void wave_stop(void)
+{
+    struct k_work_sync sync;
+
+    k_timer_stop(&wave_timer);
+    wave_on = false;
+    /* No step write after this returns, so the PWM thread owns the output again */
+    k_work_cancel_sync(&wave_work, &sync);
+}
+
+bool wave_playing(void)
+{
+    return wave_on;
+}
@@ -0,0 +1,83 @@
+/**
+ * \file GMTwave.h
+ * 
+ * \brief PWM waveform playback header
+ * 
+ * A table of duty cycles (per mille) is stepped through from a timer callback, one entry per
+ * step; the callback only picks the entry, the PWM write runs in a work item on the system
+ * work queue, outside the ISR.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef GMTWAVE_H_
+#define GMTWAVE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WAVE_TABLE_MAX 256 /**< Largest number of entries in the table */
+#define WAVE_STEP_MIN_US 100 /**< Shortest step period (in us) */
+
+/** \brief Wave load ramp
+ * 
+ * Fills the table with a ramp from 0 to 1000 per mille
+ * 
+ * \param len Number of entries, 2..WAVE_TABLE_MAX
+ * \return 0 on success, -EINVAL for an invalid length
+ */
+int wave_load_ramp(int len);
+
+/** \brief Wave load sine
+ * 
+ * Fills the table with one period of a sine between 0 and 1000 per mille, starting at 500
+ * 
+ * \param len Number of entries, 2..WAVE_TABLE_MAX
+ * \return 0 on success, -EINVAL for an invalid length
+ */
+int wave_load_sine(int len);
+
+/** \brief Wave set
+ * 
+ * Writes table entries, e.g. uploaded through the command interface
+ * 
+ * \param idx First entry
+ * \param values Duty cycles (per mille)
+ * \param n Number of entries
+ * \return 0 on success, -EINVAL if the entries do not fit or a value is above 1000
+ */
+int wave_set(int idx, const uint16_t *values, int n);
+
+/** \brief Wave set length
+ * 
+ * \param len Number of entries played, 1..WAVE_TABLE_MAX
+ * \return 0 on success, -EINVAL for an invalid length
+ */
+int wave_set_length(int len);
+
+/** \brief Wave start
+ * 
+ * Starts (or restarts) the playback from the first entry
+ * 
+ * \param step_us Time between two entries (in us), at least WAVE_STEP_MIN_US
+ * \return 0 on success, -EINVAL for an invalid period
+ */
+int wave_start(uint32_t step_us);
+
+/** \brief Wave stop
+ * 
+ * Stops the playback; the output keeps the last duty cycle until the PWM thread writes it
+ * 
+ */
+void wave_stop(void);
+
+/** \brief Wave playing
+ * 
+ * \return true while the playback owns the PWM output
+ */
+bool wave_playing(void);
+
+#endif /* GMTWAVE_H_ */
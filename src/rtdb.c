@@ -10,21 +10,325 @@
  * \author Gonçalo Tavares 
 */
 
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
 #include "rtdb.h"            
+#include "GMThist.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-struct adc_value_container adc_channel_values;
+/* ADC snapshot: ping-pong buffers, each guarded by a sequence counter (odd while being written).
+ * The writer always fills the buffer that is not current, so a reader only has to retry
+ * when it is preempted for two whole publications. */
+static struct adc_value_container adc_channel_values[2];
+static atomic_t adc_values_seq[2];
+static atomic_t adc_values_current;
+static uint32_t adc_values_count;
+struct adc_sample_ring adc_channel_rings[NUM_CHANNELS];
+
+/* Aggregates published by the writer for the readers of rtdb_stats_get() */
+struct adc_window_agg {
+    uint32_t count;
+    uint16_t min;
+    uint16_t max;
+    uint64_t sum;
+    uint64_t sum_sq;
+    uint32_t timestamp;
+};
+
+/* Incremental statistics of a channel, updated by rtdb_ring_push() in O(1) per sample.
+ * Sliding min and max come from monotonic queues of sample numbers (amortised O(1)),
+ * whose values are still in the channel's ring since the window fits in it. */
+struct adc_window {
+    enum rtdb_window_mode mode;
+    uint32_t len;
+    uint32_t n;                 /**< Samples in the running aggregates */
+    uint64_t sum;
+    uint64_t sum_sq;
+    uint16_t min;               /**< Tumbling only */
+    uint16_t max;               /**< Tumbling only */
+    uint32_t maxq[MEM_SIZE];    /**< Sliding: sample numbers with decreasing values */
+    uint32_t minq[MEM_SIZE];    /**< Sliding: sample numbers with increasing values */
+    uint8_t max_head, max_size;
+    uint8_t min_head, min_size;
+    atomic_t request;           /**< New window requested by rtdb_stats_set_window(), applied by the writer */
+    atomic_t seq;               /**< Odd while agg is being written */
+    struct adc_window_agg agg;
+};
+
+static struct adc_window adc_windows[NUM_CHANNELS];
+
+/* Subscribers: a slot is filled before the count makes it visible to the writer */
+static struct rtdb_sub *rtdb_subs[RTDB_MAX_SUBS];
+static atomic_t rtdb_sub_count;
+
+#define RTDB_WINDOW_REQUEST(mode, len) (BIT(31) | ((mode) << 16) | (len))
 
 void RTDB_init() {
     // ADC DATABASE INITIALISATION
     
+    memset(adc_channel_values, 0, sizeof(adc_channel_values));
+    atomic_set(&adc_values_seq[0], 0);
+    atomic_set(&adc_values_seq[1], 0);
+    atomic_set(&adc_values_current, 0);
+    adc_values_count = 0;
+
     for (int i = 0; i < NUM_CHANNELS; i++) {
-        adc_channel_values.original_values[i] = 0;
-        adc_channel_values.converted_values[i] = 0;
+        adc_channel_rings[i].count = 0;
+        memset(&adc_windows[i], 0, sizeof(adc_windows[i]));
+        adc_windows[i].mode = RTDB_WINDOW_SLIDING;
+        adc_windows[i].len = MEM_SIZE;
     }
     
     //
 
 
-}
\ No newline at end of file
+}
+
+/* Notifies the subscribers for which the snapshot is relevant; called by the single writer.
+ * Only the channels that triggered restart their reference, the others keep accumulating. */
+static void rtdb_notify(const struct adc_value_container *snapshot) {
+    const int n = atomic_get(&rtdb_sub_count);
+
+    for (int s = 0; s < n; s++) {
+        struct rtdb_sub *sub = rtdb_subs[s];
+        const uint32_t mask = atomic_get(&sub->mask);
+        const uint16_t threshold = atomic_get(&sub->threshold);
+        uint32_t crossed = 0;
+
+        for (int i = 0; i < NUM_CHANNELS; i++) {
+            if (!(mask & BIT(i))) {
+                continue;
+            }
+            if (threshold == 0) {
+                if (snapshot->channel_timestamps[i] != sub->last_ts[i]) {
+                    crossed |= BIT(i);
+                }
+            }
+            else if (abs((int)snapshot->converted_values[i] - sub->last[i]) >= threshold) {
+                crossed |= BIT(i);
+            }
+        }
+        if (crossed == 0) {
+            continue;
+        }
+        for (int i = 0; i < NUM_CHANNELS; i++) {
+            if (crossed & BIT(i)) {
+                sub->last[i] = snapshot->converted_values[i];
+                sub->last_ts[i] = snapshot->channel_timestamps[i];
+            }
+        }
+        k_sem_give(&sub->sem);
+    }
+}
+
+int rtdb_subscribe(struct rtdb_sub *sub, uint32_t mask, uint16_t threshold) {
+    const int n = atomic_get(&rtdb_sub_count);
+
+    if (n >= RTDB_MAX_SUBS) {
+        return -ENOMEM;
+    }
+    memset(sub, 0, sizeof(*sub));
+    atomic_set(&sub->mask, mask);
+    atomic_set(&sub->threshold, threshold);
+    k_sem_init(&sub->sem, 0, 1);
+    rtdb_subs[n] = sub;
+    atomic_set(&rtdb_sub_count, n + 1);
+    return 0;
+}
+
+void rtdb_sub_filter(struct rtdb_sub *sub, uint32_t mask, uint16_t threshold) {
+    atomic_set(&sub->mask, mask);
+    atomic_set(&sub->threshold, threshold);
+}
+
+int rtdb_wait(struct rtdb_sub *sub, struct adc_value_container *snapshot, k_timeout_t timeout) {
+    if (k_sem_take(&sub->sem, timeout) != 0) {
+        return -EAGAIN;
+    }
+    if (snapshot != NULL) {
+        rtdb_adc_read(snapshot);
+    }
+    return 0;
+}
+
+void rtdb_adc_write(const struct adc_value_container *snapshot) {
+    int idx = !atomic_get(&adc_values_current);
+
+    atomic_inc(&adc_values_seq[idx]);   /* odd: write in progress */
+    compiler_barrier();
+    adc_channel_values[idx] = *snapshot;
+    adc_channel_values[idx].seq = ++adc_values_count;
+    compiler_barrier();
+    atomic_inc(&adc_values_seq[idx]);   /* even: consistent again */
+    atomic_set(&adc_values_current, idx);
+
+    rtdb_notify(snapshot);
+}
+
+void rtdb_adc_read(struct adc_value_container *snapshot) {
+    atomic_val_t seq;
+    int idx;
+
+    do {
+        idx = atomic_get(&adc_values_current);
+        seq = atomic_get(&adc_values_seq[idx]);
+        compiler_barrier();
+        *snapshot = adc_channel_values[idx];
+        compiler_barrier();
+    } while ((seq & 1) || seq != atomic_get(&adc_values_seq[idx]));
+}
+
+static void rtdb_window_publish(struct adc_window *w, uint16_t min, uint16_t max, uint32_t timestamp) {
+    atomic_inc(&w->seq);                /* odd: write in progress */
+    compiler_barrier();
+    w->agg.count = w->n;
+    w->agg.min = min;
+    w->agg.max = max;
+    w->agg.sum = w->sum;
+    w->agg.sum_sq = w->sum_sq;
+    w->agg.timestamp = timestamp;
+    compiler_barrier();
+    atomic_inc(&w->seq);                /* even: consistent again */
+}
+
+/* Sliding window: the new sample c is already in the ring, the leaving one was removed */
+static void rtdb_window_slide(struct adc_window *w, const struct adc_sample_ring *ring, uint32_t c, uint16_t v) {
+#define RTDB_VALUE(idx) (ring->samples[(idx) % MEM_SIZE].converted_value)
+#define RTDB_AT(q, head, i) ((q)[((head) + (i)) % MEM_SIZE])
+    /* Drop the samples that left the window from the front, dominated ones from the back */
+    while (w->max_size && c - RTDB_AT(w->maxq, w->max_head, 0) >= w->len) {
+        w->max_head = (w->max_head + 1) % MEM_SIZE;
+        w->max_size--;
+    }
+    while (w->max_size && RTDB_VALUE(RTDB_AT(w->maxq, w->max_head, w->max_size - 1)) <= v) {
+        w->max_size--;
+    }
+    RTDB_AT(w->maxq, w->max_head, w->max_size++) = c;
+
+    while (w->min_size && c - RTDB_AT(w->minq, w->min_head, 0) >= w->len) {
+        w->min_head = (w->min_head + 1) % MEM_SIZE;
+        w->min_size--;
+    }
+    while (w->min_size && RTDB_VALUE(RTDB_AT(w->minq, w->min_head, w->min_size - 1)) >= v) {
+        w->min_size--;
+    }
+    RTDB_AT(w->minq, w->min_head, w->min_size++) = c;
+
+    rtdb_window_publish(w, RTDB_VALUE(RTDB_AT(w->minq, w->min_head, 0)),
+                        RTDB_VALUE(RTDB_AT(w->maxq, w->max_head, 0)), ring->samples[c % MEM_SIZE].timestamp);
+#undef RTDB_AT
+#undef RTDB_VALUE
+}
+
+void rtdb_ring_push(int ch, uint32_t timestamp, uint16_t original_value, uint16_t converted_value) {
+    struct adc_sample_ring *ring = &adc_channel_rings[ch];
+    struct adc_ts_sample *slot = &ring->samples[ring->count % MEM_SIZE];
+    struct adc_window *w = &adc_windows[ch];
+    const uint32_t c = ring->count;
+    atomic_val_t request = atomic_set(&w->request, 0);
+
+    /* New window: restart the aggregates */
+    if (request) {
+        w->mode = (enum rtdb_window_mode)((request >> 16) & 0xff);
+        w->len = request & 0xffff;
+        w->n = 0;
+        w->sum = 0;
+        w->sum_sq = 0;
+        w->max_size = 0;
+        w->min_size = 0;
+    }
+    /* Sliding window full: remove the leaving sample before the ring overwrites it */
+    if (w->mode == RTDB_WINDOW_SLIDING && w->n == w->len) {
+        uint16_t old = ring->samples[(c - w->len) % MEM_SIZE].converted_value;
+
+        w->sum -= old;
+        w->sum_sq -= (uint32_t)old * old;
+        w->n--;
+    }
+
+    slot->timestamp = timestamp;
+    slot->original_value = original_value;
+    slot->converted_value = converted_value;
+    ring->count++;
+#if HIST_ENABLE
+    hist_push(ch, timestamp, original_value);
+#endif
+
+    w->sum += converted_value;
+    w->sum_sq += (uint32_t)converted_value * converted_value;
+    if (w->mode == RTDB_WINDOW_SLIDING) {
+        w->n++;
+        rtdb_window_slide(w, ring, c, converted_value);
+        return;
+    }
+    /* Tumbling window: publish each completed block */
+    if (w->n++ == 0) {
+        w->min = converted_value;
+        w->max = converted_value;
+    }
+    w->min = MIN(w->min, converted_value);
+    w->max = MAX(w->max, converted_value);
+    if (w->n == w->len) {
+        rtdb_window_publish(w, w->min, w->max, timestamp);
+        w->n = 0;
+        w->sum = 0;
+        w->sum_sq = 0;
+    }
+}
+
+int rtdb_stats_set_window(int ch, enum rtdb_window_mode mode, int len) {
+    const int max = (mode == RTDB_WINDOW_SLIDING) ? MEM_SIZE : RTDB_TUMBLING_MAX;
+
+    if (ch < 0 || ch >= NUM_CHANNELS || len < 1 || len > max ||
+        (mode != RTDB_WINDOW_SLIDING && mode != RTDB_WINDOW_TUMBLING)) {
+        return -EINVAL;
+    }
+    atomic_set(&adc_windows[ch].request, RTDB_WINDOW_REQUEST(mode, len));
+    return 0;
+}
+
+/* Integer square root, floor */
+static uint32_t rtdb_isqrt(uint64_t x) {
+    uint64_t r = 0, bit = 1ULL << 62;
+
+    while (bit > x) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)r;
+}
+
+int rtdb_stats_get(int ch, struct adc_stats *stats) {
+    struct adc_window_agg agg;
+    atomic_val_t seq;
+
+    if (ch < 0 || ch >= NUM_CHANNELS) {
+        return -EINVAL;
+    }
+    do {
+        seq = atomic_get(&adc_windows[ch].seq);
+        compiler_barrier();
+        agg = adc_windows[ch].agg;
+        compiler_barrier();
+    } while ((seq & 1) || seq != atomic_get(&adc_windows[ch].seq));
+
+    *stats = (struct adc_stats){.count = agg.count, .min = agg.min, .max = agg.max, .timestamp = agg.timestamp};
+    if (agg.count > 0) {
+        stats->mean = (uint16_t)(agg.sum / agg.count);
+        stats->variance = (uint32_t)((agg.sum_sq - agg.sum * agg.sum / agg.count) / agg.count);
+        stats->rms = (uint16_t)rtdb_isqrt(agg.sum_sq / agg.count);
+    }
+    return 0;
+}
@@ -16,17 +16,65 @@
 
 #include <inttypes.h>
 #include <stdint.h>
+#include <zephyr/kernel.h>
 #include "GMTadc.h"
 
 
 // INPUT VALUES
 
+/** Snapshot of all ADC channels taken in the same cycle */
 struct adc_value_container {
-    uint16_t original_values[4];
-    uint16_t converted_values[4];
+    uint16_t original_values[NUM_CHANNELS];
+    uint16_t converted_values[NUM_CHANNELS];
+    uint32_t timestamp;         /**< Time of the conversion (in us) */
+    uint32_t channel_timestamps[NUM_CHANNELS]; /**< Time of the sample behind each channel's values (in us) */
+    uint32_t seq;               /**< Snapshot sequence number, set by rtdb_adc_write() */
 };
 
-extern struct adc_value_container adc_channel_values;
+/** One timestamped sample of a channel */
+struct adc_ts_sample {
+    uint32_t timestamp;         /**< Time of the conversion (in us) */
+    uint16_t original_value;
+    uint16_t converted_value;
+};
+
+/** Ring with the last MEM_SIZE samples of a channel */
+struct adc_sample_ring {
+    struct adc_ts_sample samples[MEM_SIZE];
+    uint32_t count;             /**< Total number of samples pushed; newest is at (count - 1) % MEM_SIZE */
+};
+
+extern struct adc_sample_ring adc_channel_rings[NUM_CHANNELS];
+
+#define RTDB_MAX_SUBS 4 /**< Maximum number of snapshot subscribers */
+
+/** Subscriber to snapshot publications (see rtdb_subscribe()) */
+struct rtdb_sub {
+    atomic_t mask;              /**< Channels of interest */
+    atomic_t threshold;         /**< Change of a converted value (in mV) that notifies; 0: any new sample */
+    uint16_t last[NUM_CHANNELS];     /**< Converted values at the last notification, writer only */
+    uint32_t last_ts[NUM_CHANNELS];  /**< Channel timestamps at the last notification, writer only */
+    struct k_sem sem;           /**< Given by rtdb_adc_write() on a relevant publication */
+};
+
+/** Statistics window of a channel */
+enum rtdb_window_mode {
+    RTDB_WINDOW_SLIDING,        /**< The last len samples, updated on every sample (len up to MEM_SIZE) */
+    RTDB_WINDOW_TUMBLING,       /**< Consecutive blocks of len samples, updated when a block completes */
+};
+
+#define RTDB_TUMBLING_MAX 9999 /**< Longest tumbling window (in samples) */
+
+/** Statistics of a channel's converted values (in mV) over its window */
+struct adc_stats {
+    uint32_t count;             /**< Samples in the window */
+    uint16_t min;
+    uint16_t max;
+    uint16_t mean;
+    uint16_t rms;
+    uint32_t variance;          /**< Population variance (in mV^2) */
+    uint32_t timestamp;         /**< Time of the newest sample of the window (in us) */
+};
 
 // OUTPUT VALUES
 
@@ -41,4 +89,91 @@ extern struct adc_value_container adc_channel_values;
  */
 void RTDB_init();
 
+/** \brief rtdb_adc_write()
+ * 
+ * Publishes a new ADC snapshot. Never blocks; there must be a single writer.
+ * The snapshot is written to the buffer readers are not using and then made current.
+ * 
+ * \param snapshot Values and timestamp to publish; its seq field is ignored
+ */
+void rtdb_adc_write(const struct adc_value_container *snapshot);
+
+/** \brief rtdb_adc_read()
+ * 
+ * Copies the latest consistent ADC snapshot. Never blocks; it only retries
+ * if the writer published twice while the copy was being made.
+ * 
+ * \param snapshot Destination of the copy
+ */
+void rtdb_adc_read(struct adc_value_container *snapshot);
+
+/** \brief rtdb_subscribe()
+ * 
+ * Registers a subscriber, notified by rtdb_adc_write() when a snapshot has a new sample of a
+ * channel in the mask (threshold 0) or a converted value that moved by at least threshold mV
+ * since the last notification. Notifications coalesce: a subscriber that is late sees one.
+ * Subscribers register from a single thread, normally during setup.
+ * 
+ * \param sub Subscriber, must stay valid
+ * \param mask Channels of interest
+ * \param threshold Change (in mV) that notifies, 0 for every new sample
+ * \return 0 on success, -ENOMEM if RTDB_MAX_SUBS subscribers are registered
+ */
+int rtdb_subscribe(struct rtdb_sub *sub, uint32_t mask, uint16_t threshold);
+
+/** \brief rtdb_sub_filter()
+ * 
+ * Changes the filter of a subscriber, from the next publication on
+ * 
+ * \param sub Subscriber
+ * \param mask Channels of interest
+ * \param threshold Change (in mV) that notifies, 0 for every new sample
+ */
+void rtdb_sub_filter(struct rtdb_sub *sub, uint32_t mask, uint16_t threshold);
+
+/** \brief rtdb_wait()
+ * 
+ * Blocks until the subscriber is notified, then copies the latest snapshot
+ * 
+ * \param sub Subscriber
+ * \param snapshot Destination of the copy, or NULL
+ * \param timeout Longest wait
+ * \return 0 when notified, -EAGAIN on timeout
+ */
+int rtdb_wait(struct rtdb_sub *sub, struct adc_value_container *snapshot, k_timeout_t timeout);
+
+/** \brief rtdb_ring_push()
+ * 
+ * Appends one timestamped sample to the ring of a channel, overwriting the oldest one when full
+ * 
+ * \param ch Channel index
+ * \param timestamp Time of the conversion (in us)
+ * \param original_value Raw ADC value
+ * \param converted_value Value in mV
+ */
+void rtdb_ring_push(int ch, uint32_t timestamp, uint16_t original_value, uint16_t converted_value);
+
+/** \brief rtdb_stats_set_window()
+ * 
+ * Selects the statistics window of a channel. The aggregates restart empty on the
+ * channel's next sample.
+ * 
+ * \param ch Channel index
+ * \param mode Sliding or tumbling
+ * \param len Number of samples, 1..MEM_SIZE (sliding) or 1..RTDB_TUMBLING_MAX (tumbling)
+ * \return 0 on success, -EINVAL for an invalid channel or length
+ */
+int rtdb_stats_set_window(int ch, enum rtdb_window_mode mode, int len);
+
+/** \brief rtdb_stats_get()
+ * 
+ * Copies the statistics of a channel: the current sliding window, or the last completed
+ * tumbling window. Never blocks.
+ * 
+ * \param ch Channel index
+ * \param stats Destination
+ * \return 0 on success, -EINVAL for an invalid channel
+ */
+int rtdb_stats_get(int ch, struct adc_stats *stats);
+
 #endif /* RTDB_H_ */
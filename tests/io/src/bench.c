@@ -0,0 +1,61 @@
+/**
+ * \file bench.c
+ * 
+ * \brief Benchmark helpers code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>      /* for printk()*/
+#include <zephyr/timing/timing.h>   /* for timing services */
+#include "bench.h"
+
+#ifdef CONFIG_NATIVE_LIBRARY
+uint64_t bench_host_ns(void);       /* bench_host.c, host side */
+#else
+static timing_t bench_origin;       /**< Timing counter at the first bench_now() */
+static bool bench_started;
+#endif
+
+void bench_init(struct bench *b, const char *name)
+{
+    *b = (struct bench){0};
+    b->name = name;
+    b->min = UINT64_MAX;
+}
+
+uint64_t bench_now(void)
+{
+#ifdef CONFIG_NATIVE_LIBRARY
+    return bench_host_ns();
+#else
+    timing_t now;
+
+    /* The timing counter is 64 bits wide on every architecture, unlike k_cycle_get_64() */
+    if (!bench_started) {
+        bench_origin = timing_counter_get();
+        bench_started = true;
+    }
+    now = timing_counter_get();
+    return timing_cycles_to_ns(timing_cycles_get(&bench_origin, &now));
+#endif
+}
+
+void bench_add(struct bench *b, uint64_t ns)
+{
+    b->n++;
+    b->sum += ns;
+    b->min = MIN(b->min, ns);
+    b->max = MAX(b->max, ns);
+}
+
+void bench_report(const struct bench *b)
+{
+    printk("BENCH,%s,%u,%llu,%llu,%llu\n", b->name, b->n, (unsigned long long)(b->n ? b->min : 0),
+           (unsigned long long)(b->n ? b->sum / b->n : 0), (unsigned long long)b->max);
+}
@@ -0,0 +1,61 @@
+/**
+ * \file bench.h
+ * 
+ * \brief Benchmark helpers header
+ * 
+ * Each benchmark is reported as one CSV line, BENCH,name,n,min_ns,mean_ns,max_ns, which twister
+ * collects in recording.csv (see testcase.yaml) to compare runs. On native_sim the kernel clock
+ * only advances while the CPU idles, so the code under test is timed with the host clock there
+ * (bench_host.c); elsewhere with the timing counter (timing_init() and timing_start() in fixture_init()).
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+
+#define BENCH_RUNS 1000 /**< Default number of timed runs of a microbenchmark */
+
+/** Figures of one benchmark (in ns) */
+struct bench {
+    const char *name;
+    uint32_t n;                 /**< Timed runs */
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+};
+
+/** \brief Bench init
+ * 
+ * \param b Benchmark
+ * \param name Name in the report, without commas
+ */
+void bench_init(struct bench *b, const char *name);
+
+/** \brief Bench now
+ * 
+ * \return time (in ns) of the clock that times the code under test
+ */
+uint64_t bench_now(void);
+
+/** \brief Bench add
+ * 
+ * \param b Benchmark
+ * \param ns Duration of one run (in ns)
+ */
+void bench_add(struct bench *b, uint64_t ns);
+
+/** \brief Bench report
+ * 
+ * Prints the CSV line of a benchmark
+ * 
+ * \param b Benchmark
+ */
+void bench_report(const struct bench *b);
+
+#endif /* BENCH_H_ */
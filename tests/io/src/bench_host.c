@@ -0,0 +1,24 @@
+/**
+ * \file bench_host.c
+ * 
+ * \brief Host clock of the benchmarks on native_sim
+ * 
+ * Built against the host C library (native_simulator target), not the Zephyr one.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <stdint.h>
+#include <time.h>
+
+uint64_t bench_host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
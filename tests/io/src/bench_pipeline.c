@@ -0,0 +1,167 @@
+/**
+ * \file bench_pipeline.c
+ * 
+ * \brief Acquisition and command pipeline microbenchmarks
+ * 
+ * adc_collect() on the ADC emulator, the conversion of a block of every code, RTDB writes and
+ * reads, cmdProcess() for the main command kinds, and one analog job with its readings logged
+ * through the deferred log and printed synchronously; each reported by bench_report().
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include <string.h>
+#include "fixture.h"
+#include "bench.h"
+#include "GMTadc.h"
+#include "GMTcmd.h"
+#include "GMTlog.h"
+#include "rtdb.h"
+
+#define BENCH_BLOCK (ADC_MAX_CODE + 1) /**< Samples of the conversion benchmark: every code once */
+#define BENCH_LOG_RUNS 100 /**< Runs of the logging benchmark, each prints NUM_CHANNELS lines */
+
+static void *bench_setup(void)
+{
+    fixture_init();
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        fixture_set_input(i, 750 * i);
+    }
+    return NULL;
+}
+
+ZTEST(bench, test_adc_collect)
+{
+    struct bench b;
+
+    bench_init(&b, "adc_collect");
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        const uint64_t t0 = bench_now();
+
+        zassert_ok(adc_collect());
+        bench_add(&b, bench_now() - t0);
+    }
+    bench_report(&b);
+}
+
+ZTEST(bench, test_adc_convert_block)
+{
+    static uint16_t raw[BENCH_BLOCK];
+    static uint16_t mv[BENCH_BLOCK];
+    struct bench b;
+
+    for (int j = 0; j < BENCH_BLOCK; j++) {
+        raw[j] = j;
+    }
+    bench_init(&b, "adc_convert_block_1024");
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        const uint64_t t0 = bench_now();
+
+        adc_convert_block(0, raw, 1, mv, BENCH_BLOCK);
+        bench_add(&b, bench_now() - t0);
+    }
+    bench_report(&b);
+    zassert_equal(mv[BENCH_BLOCK - 1], ADC_FULL_SCALE_MV);
+}
+
+ZTEST(bench, test_rtdb_write)
+{
+    struct adc_value_container snapshot;
+    struct bench b;
+
+    rtdb_adc_read(&snapshot);
+    bench_init(&b, "rtdb_adc_write");
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        const uint64_t t0 = bench_now();
+
+        rtdb_adc_write(&snapshot);
+        bench_add(&b, bench_now() - t0);
+    }
+    bench_report(&b);
+}
+
+ZTEST(bench, test_rtdb_read)
+{
+    struct adc_value_container snapshot;
+    struct bench b;
+
+    bench_init(&b, "rtdb_adc_read");
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        const uint64_t t0 = bench_now();
+
+        rtdb_adc_read(&snapshot);
+        bench_add(&b, bench_now() - t0);
+    }
+    bench_report(&b);
+}
+
+ZTEST(bench, test_cmd_process)
+{
+    /* Frame bodies, as the parser delivers them, and the name of their figures */
+    static const struct {
+        const char *name;
+        const char *str;
+    } cmds[] = {
+        {"cmdProcess_period", "TI1000"},
+        {"cmdProcess_map", "PM0X"},
+        {"cmdProcess_window", "QS0064"},
+        {"cmdProcess_filter", "F0N"},
+        {"cmdProcess_batch", "CP=0100,CI=0010,CD=0000"},
+    };
+
+    for (int c = 0; c < ARRAY_SIZE(cmds); c++) {
+        struct cmd_frame frame = {.len = strlen(cmds[c].str)};
+        struct bench b;
+
+        memcpy(frame.str, cmds[c].str, frame.len);
+        bench_init(&b, cmds[c].name);
+        for (int k = 0; k < BENCH_RUNS; k++) {
+            const uint64_t t0 = bench_now();
+            const int ret = cmdProcess(&frame);
+
+            bench_add(&b, bench_now() - t0);
+            zassert_equal(ret, 0, "%s", cmds[c].str);
+            cmd_commit();   /* a staged batch is applied at the cycle boundary */
+        }
+        bench_report(&b);
+    }
+}
+
+/* One analog job as thread_an_code() runs it in text mode: scan, then adc_print(). Deferred, the
+ * ring is drained after each run, outside the timed region, as the log thread would. */
+ZTEST(bench, test_an_job_log)
+{
+    static const struct {
+        const char *name;
+        bool deferred;
+    } paths[] = {
+        {"an_job_dlog_push", true},
+        {"an_job_printk", false},
+    };
+
+    for (int p = 0; p < ARRAY_SIZE(paths); p++) {
+        const uint32_t dropped = dlog_dropped();
+        struct bench b;
+
+        dlog_set_deferred(paths[p].deferred);
+        bench_init(&b, paths[p].name);
+        for (int k = 0; k < BENCH_LOG_RUNS; k++) {
+            const uint64_t t0 = bench_now();
+
+            zassert_ok(adc_collect());
+            adc_print();
+            bench_add(&b, bench_now() - t0);
+            dlog_drain();
+        }
+        bench_report(&b);
+        zassert_equal(dlog_dropped(), dropped, "records dropped");
+    }
+    dlog_set_deferred(DLOG_DEFERRED);
+}
+
+ZTEST_SUITE(bench, NULL, bench_setup, NULL, NULL, NULL);
@@ -0,0 +1,70 @@
+/**
+ * \file bench_scan.c
+ * 
+ * \brief Multi-channel scan tests and benchmark
+ * 
+ * One adc_read() sequence over the scan mask against one adc_read() per channel, the way
+ * adc_collect() sampled before the scan mode, on the ADC emulator.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include "fixture.h"
+#include "bench.h"
+#include "GMTadc.h"
+#include "rtdb.h"
+
+static void *scan_setup(void)
+{
+    fixture_init();
+    return NULL;
+}
+
+/* Each result of the scan sequence lands on its own channel */
+ZTEST(scan, test_scan_channel_order)
+{
+    static const uint32_t mv[NUM_CHANNELS] = {2800, 300, 1700, 900};
+    struct adc_value_container snapshot;
+    uint16_t raw, conv;
+
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        zassert_ok(fixture_set_input(i, mv[i]));
+    }
+    zassert_ok(adc_collect());
+    rtdb_adc_read(&snapshot);
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        zassert_ok(adc_sample_mv(i, &raw, &conv));
+        zassert_equal(snapshot.original_values[i], raw, "channel %d", i);
+        zassert_equal(snapshot.converted_values[i], conv, "channel %d", i);
+    }
+}
+
+/* Per-cycle acquisition cost: one sequence per channel (before) against one scan (after) */
+ZTEST(scan, test_scan_latency)
+{
+    struct bench per_channel, scan;
+
+    bench_init(&per_channel, "adc_sample_per_channel");
+    bench_init(&scan, "adc_scan");
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        uint64_t t0 = bench_now();
+
+        for (int i = 0; i < NUM_CHANNELS; i++) {
+            zassert_ok(adc_sample(i));
+        }
+        bench_add(&per_channel, bench_now() - t0);
+
+        t0 = bench_now();
+        zassert_ok(adc_scan(ADC_SCAN_MASK));
+        bench_add(&scan, bench_now() - t0);
+    }
+    bench_report(&per_channel);
+    bench_report(&scan);
+}
+
+ZTEST_SUITE(scan, NULL, scan_setup, NULL, NULL, NULL);
@@ -0,0 +1,169 @@
+/**
+ * \file fixture.c
+ * 
+ * \brief Test fixture code
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/adc/adc_emul.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/pwm.h>
+#include <zephyr/drivers/pwm/pwm_fake.h>
+#include <zephyr/drivers/serial/uart_emul.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/fff.h>
+#include <zephyr/timing/timing.h>
+#include <string.h>
+#include "fixture.h"
+#include "GMTadc.h"
+#include "GMTpwm.h"
+#include "GMTlog.h"
+#include "GMTctrl.h"
+#include "GMTjob.h"
+#include "rtdb.h"
+
+DEFINE_FFF_GLOBALS;
+
+#define fixture_stacksize 2048 /**< Size of the command and PWM thread stacks */
+#define fixture_pwm_prio 3 /**< Priority of the PWM thread, as thread_pwm_prio */
+#define fixture_cmd_prio 4 /**< Priority of the command thread, as thread_cmd_prio */
+
+const struct device *const fixture_adc = DEVICE_DT_GET(DT_NODELABEL(adc));
+const struct device *const fixture_uart = DEVICE_DT_GET(DT_NODELABEL(euart0));
+const struct device *const fixture_telem_uart = DEVICE_DT_GET(DT_NODELABEL(euart1));
+
+K_MSGQ_DEFINE(fixture_pwm_msgq, sizeof(struct fixture_pwm_write), FIXTURE_PWM_WRITES, 4);
+K_MSGQ_DEFINE(fixture_cmd_msgq, sizeof(struct fixture_cmd_done), FIXTURE_CMD_DONE, 4);
+
+K_THREAD_STACK_DEFINE(fixture_cmd_stack, fixture_stacksize);
+K_THREAD_STACK_DEFINE(fixture_pwm_stack, fixture_stacksize);
+static struct k_thread fixture_cmd_data;
+static struct k_thread fixture_pwm_data;
+static bool fixture_running;
+static atomic_t fixture_cmd_res;
+
+/* Fake PWM driver: queues every write with its time; a full queue drops it */
+static int fixture_pwm_set_cycles(const struct device *dev, uint32_t channel, uint32_t period,
+                                  uint32_t pulse, pwm_flags_t flags)
+{
+    const struct fixture_pwm_write write = {
+        .channel = channel,
+        .pulse = pulse,
+        .cycle = k_cycle_get_32(),
+    };
+
+    k_msgq_put(&fixture_pwm_msgq, &write, K_NO_WAIT);
+    return 0;
+}
+
+/* Called by the command thread of GMTjob after each frame */
+static void fixture_cmd_hook(int result)
+{
+    const struct fixture_cmd_done done = {
+        .result = result,
+        .cycle = k_cycle_get_32(),
+    };
+
+    atomic_set(&fixture_cmd_res, result);
+    k_msgq_put(&fixture_cmd_msgq, &done, K_NO_WAIT);
+}
+
+void fixture_init(void)
+{
+    static bool ready;
+
+    if (ready) {
+        return;
+    }
+    ready = true;
+
+    RTDB_init();
+    dlog_init();
+    timing_init();
+    timing_start();
+    job_init();
+    job_set_cmd_hook(fixture_cmd_hook);
+    gpio_pin_configure_dt(&led1, GPIO_OUTPUT_ACTIVE);
+
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        fixture_set_input(i, 0);
+    }
+    fake_pwm_set_cycles_fake.custom_fake = fixture_pwm_set_cycles;
+    adc_init();
+    pwm_init();
+    ctrl_init();
+
+    job_uart_start(fixture_uart);
+    job_telem_uart_start(fixture_telem_uart);
+}
+
+int fixture_set_input(int ch, uint32_t mv)
+{
+    return adc_emul_const_value_set(fixture_adc, ch, mv);
+}
+
+void fixture_send(const char *str)
+{
+    uart_emul_put_rx_data(fixture_uart, (const uint8_t *)str, strlen(str));
+}
+
+void fixture_pipeline_start(void)
+{
+    if (fixture_running) {
+        return;
+    }
+    fixture_running = true;
+    k_thread_create(&fixture_cmd_data, fixture_cmd_stack, K_THREAD_STACK_SIZEOF(fixture_cmd_stack),
+                    thread_cmd_code, NULL, NULL, NULL, fixture_cmd_prio, 0, K_NO_WAIT);
+    k_thread_create(&fixture_pwm_data, fixture_pwm_stack, K_THREAD_STACK_SIZEOF(fixture_pwm_stack),
+                    thread_pwm_code, NULL, NULL, NULL, fixture_pwm_prio, 0, K_NO_WAIT);
+}
+
+void fixture_pipeline_stop(void)
+{
+    if (fixture_running) {
+        k_thread_abort(&fixture_cmd_data);
+        k_thread_abort(&fixture_pwm_data);
+        fixture_running = false;
+    }
+    /* Left set by a PWM thread stopped while it followed the mapped inputs */
+    ptask_set_release_src(&task_pwm, NULL);
+    for (int i = 0; i < PWM_NUM_OUTPUTS; i++) {
+        pwm_bank_map(i, PWM_UNMAPPED);
+    }
+    fixture_pwm_reset();
+    k_msgq_purge(&fixture_cmd_msgq);
+}
+
+int fixture_cmd_result(void)
+{
+    return atomic_get(&fixture_cmd_res);
+}
+
+int fixture_cmd_wait(struct fixture_cmd_done *done, k_timeout_t timeout)
+{
+    return (k_msgq_get(&fixture_cmd_msgq, done, timeout) == 0) ? 0 : -EAGAIN;
+}
+
+int fixture_pwm_wait(uint32_t channel, struct fixture_pwm_write *write, k_timeout_t timeout)
+{
+    do {
+        if (k_msgq_get(&fixture_pwm_msgq, write, timeout) != 0) {
+            return -EAGAIN;
+        }
+    } while (write->channel != channel);
+    return 0;
+}
+
+void fixture_pwm_reset(void)
+{
+    k_msgq_purge(&fixture_pwm_msgq);
+}
@@ -0,0 +1,115 @@
+/**
+ * \file fixture.h
+ * 
+ * \brief Test fixture header
+ * 
+ * Stands in for main.c on native_sim: it sets up the modules and hands the emulated UARTs to the
+ * callbacks of GMTjob as startup_config() does, and creates the command and PWM threads with the
+ * thread code of GMTjob at the priorities of main.c. Every PWM write reaches the fake PWM driver,
+ * which queues it with the kernel cycle counter for fixture_pwm_wait().
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares
+*/
+#ifndef FIXTURE_H_
+#define FIXTURE_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <stdint.h>
+#include "GMTcmd.h"
+
+#define FIXTURE_ADC_TOL_MV 6 /**< Error of an emulated input read back in mV: two codes of 2.93 mV */
+#define FIXTURE_PWM_WRITES 16 /**< PWM writes queued for fixture_pwm_wait() */
+#define FIXTURE_CMD_DONE 8 /**< Processed frames queued for fixture_cmd_wait() */
+
+/** PWM write seen by the fake PWM driver */
+struct fixture_pwm_write {
+    uint32_t channel;           /**< Output of the bank */
+    uint32_t pulse;             /**< Pulse (in PWM cycles of 1 us) */
+    uint32_t cycle;             /**< Kernel cycle counter at the write (k_cycle_get_32()) */
+};
+
+/** Frame processed by the command thread, reported by its command hook */
+struct fixture_cmd_done {
+    int result;                 /**< Value returned by cmdProcess() */
+    uint32_t cycle;             /**< Kernel cycle counter once processed (k_cycle_get_32()) */
+};
+
+extern const struct device *const fixture_adc;          /**< ADC emulator */
+extern const struct device *const fixture_uart;         /**< Command UART emulator */
+extern const struct device *const fixture_telem_uart;   /**< Telemetry UART emulator */
+
+/** \brief Fixture init
+ * 
+ * Sets up the RTDB, the tasks, the ADC, the PWM bank and both UARTs once; later calls do nothing.
+ * Every emulated input starts at 0 mV.
+ */
+void fixture_init(void);
+
+/** \brief Fixture set input
+ * 
+ * \param ch ADC channel
+ * \param mv Voltage of the emulated input (in mV)
+ * \return 0 on success, negative error code on failure
+ */
+int fixture_set_input(int ch, uint32_t mv);
+
+/** \brief Fixture send
+ * 
+ * Puts bytes on the RX line of the command UART, as a host would send them
+ * 
+ * \param str Bytes, e.g. "$TI0100&"
+ */
+void fixture_send(const char *str);
+
+/** \brief Fixture pipeline start
+ * 
+ * Starts the command thread (thread_cmd_code()) and the PWM thread (thread_pwm_code(): on the
+ * release grid of task_pwm, or on RTDB notifications while outputs are mapped with PWM_ON_CHANGE).
+ */
+void fixture_pipeline_start(void);
+
+/** \brief Fixture pipeline stop
+ * 
+ * Stops both threads, unmaps every bank output and forgets the queued PWM writes and processed frames
+ */
+void fixture_pipeline_stop(void);
+
+/** \brief Fixture command result
+ * 
+ * \return value returned by cmdProcess() for the last frame of the command thread
+ */
+int fixture_cmd_result(void);
+
+/** \brief Fixture command wait
+ * 
+ * Waits until the command thread has processed the next frame
+ * 
+ * \param done Destination of the result and time of the frame
+ * \param timeout Longest wait
+ * \return 0 on success, -EAGAIN on timeout
+ */
+int fixture_cmd_wait(struct fixture_cmd_done *done, k_timeout_t timeout);
+
+/** \brief Fixture PWM wait
+ * 
+ * Waits for the next write of one output, dropping the writes of the other outputs
+ * 
+ * \param channel Output of the bank
+ * \param write Destination of the write
+ * \param timeout Longest wait
+ * \return 0 on success, -EAGAIN on timeout
+ */
+int fixture_pwm_wait(uint32_t channel, struct fixture_pwm_write *write, k_timeout_t timeout);
+
+/** \brief Fixture PWM reset
+ * 
+ * Forgets the queued PWM writes
+ */
+void fixture_pwm_reset(void);
+
+#endif /* FIXTURE_H_ */
@@ -0,0 +1,149 @@
+/**
+ * \file test_adc_hr.c
+ * 
+ * \brief High-rate acquisition tests
+ * 
+ * adc_hr_run() on the ADC emulator, in its own thread as the analog thread runs it: blocks
+ * published to the channel rings with their values and timestamps, no late scan, and the return
+ * to the caller when the mode is left. Paced by the emulated counter (native_sim), any period is
+ * kept to the us and the samples are exactly one period apart; paced by the kernel timer
+ * (qemu_x86), periods that are not a whole number of ticks are rounded up to the tick, and the
+ * late-scan count must not move for them either.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include "fixture.h"
+#include "GMTadc.h"
+#include "rtdb.h"
+
+#define HR_PERIOD_US 10000 /**< Period of the test, a whole number of kernel ticks */
+#define HR_ODD_PERIOD_US 15001 /**< Period of the test that is not a whole number of kernel ticks */
+#define HR_BLOCKS 4 /**< Blocks the test lets run */
+#define HR_STACKSIZE 2048 /**< Size of the high-rate thread stack */
+#define HR_PRIO 5 /**< Priority of the high-rate thread */
+
+K_THREAD_STACK_DEFINE(hr_stack, HR_STACKSIZE);
+static struct k_thread hr_data;
+static atomic_t hr_result;
+
+/* As the analog thread in the high-rate mode */
+static void hr_code(void *argA, void *argB, void *argC)
+{
+    atomic_set(&hr_result, adc_hr_run());
+}
+
+static void *hr_setup(void)
+{
+    fixture_init();
+    return NULL;
+}
+
+static void hr_after(void *f)
+{
+    adc_hr_set_period(0);
+}
+
+ZTEST(adc_hr, test_hr_period_range)
+{
+    const uint32_t tick_us = k_ticks_to_us_floor32(1);
+    int used;
+
+    zassert_equal(adc_hr_set_period(ADC_HR_MIN_US - 1), -EINVAL);
+    zassert_equal(adc_hr_set_period(ADC_HR_MAX_US + 1), -EINVAL);
+    zassert_equal(adc_hr_period(), 0);
+    used = adc_hr_set_period(ADC_HR_MIN_US);
+    zassert_equal(adc_hr_period(), used);
+    if (ADC_HR_COUNTER) {
+        /* The 1 MHz counter keeps the period to the us */
+        zassert_equal(used, ADC_HR_MIN_US, "%d us", used);
+        zassert_equal(adc_hr_set_period(HR_ODD_PERIOD_US), HR_ODD_PERIOD_US);
+    }
+    else {
+        /* Rounded up to a whole number of ticks, which the driver's timer gives back unchanged */
+        zassert_true(used >= ADC_HR_MIN_US && used <= ADC_HR_MIN_US + tick_us, "%d us", used);
+        zassert_equal(k_us_to_ticks_ceil32(used), k_us_to_ticks_ceil32(ADC_HR_MIN_US));
+    }
+    zassert_equal(adc_hr_set_period(HR_PERIOD_US), HR_PERIOD_US);
+    zassert_equal(adc_hr_set_period(0), 0);
+    zassert_equal(adc_hr_period(), 0);
+}
+
+/* Runs HR_BLOCKS blocks at period_us and checks the rings and the late-scan count */
+static void hr_run_blocks(uint32_t period_us)
+{
+    static const uint32_t mv[NUM_CHANNELS] = {500, 1000, 1500, 2000};
+    const uint32_t missed = adc_hr_missed();
+    uint32_t count[NUM_CHANNELS];
+    int period;
+
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        zassert_ok(fixture_set_input(i, mv[i]));
+        count[i] = adc_channel_rings[i].count;
+    }
+    period = adc_hr_set_period(period_us);
+    zassert_true(period >= (int)period_us, "period %d us", period);
+    atomic_set(&hr_result, 1);
+    k_thread_create(&hr_data, hr_stack, K_THREAD_STACK_SIZEOF(hr_stack), hr_code, NULL, NULL, NULL,
+                    HR_PRIO, 0, K_NO_WAIT);
+
+    k_msleep(HR_BLOCKS * ADC_HR_BLOCK * period / USEC_PER_MSEC);
+    zassert_equal(adc_hr_set_period(0), 0);
+    /* The running block ends at its next scan */
+    zassert_ok(k_thread_join(&hr_data, K_USEC(4 * period)), "adc_hr_run() did not return");
+    zassert_equal(atomic_get(&hr_result), 0);
+    zassert_equal(adc_hr_missed(), missed, "%u late scans", adc_hr_missed() - missed);
+
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        const struct adc_sample_ring *ring = &adc_channel_rings[i];
+        const uint32_t n = ring->count - count[i];
+
+        zassert_true(n >= (HR_BLOCKS - 1) * ADC_HR_BLOCK, "channel %d: %u samples", i, n);
+        /* The newest samples: the emulated input, one period apart within a block; a block starts
+         * as soon as the previous one completes, so no step is ever longer than a period. On the
+         * counter every sample is stamped on its grid: each step is the period. */
+        for (uint32_t c = ring->count - MIN(n, MEM_SIZE); c < ring->count; c++) {
+            const struct adc_ts_sample *s = &ring->samples[c % MEM_SIZE];
+
+            zassert_within(s->converted_value, mv[i], FIXTURE_ADC_TOL_MV, "channel %d: %u mV", i,
+                           s->converted_value);
+            if (c > ring->count - MIN(n, MEM_SIZE)) {
+                const uint32_t dt = s->timestamp - ring->samples[(c - 1) % MEM_SIZE].timestamp;
+
+                if (ADC_HR_COUNTER) {
+                    zassert_equal(dt, period, "channel %d: %u us between samples", i, dt);
+                }
+                else {
+                    zassert_true((int32_t)dt >= 0 && dt <= period + period / 10,
+                                 "channel %d: %u us between samples", i, dt);
+                }
+            }
+        }
+    }
+}
+
+ZTEST(adc_hr, test_hr_blocks)
+{
+    hr_run_blocks(HR_PERIOD_US);
+}
+
+/* The counter runs at the period itself; the kernel timer at the period rounded up to the tick,
+ * and scans on that grid are not late */
+ZTEST(adc_hr, test_hr_blocks_odd_period)
+{
+    if (ADC_HR_COUNTER) {
+        zassert_equal(adc_hr_set_period(HR_ODD_PERIOD_US), HR_ODD_PERIOD_US, "period rounded");
+    }
+    else {
+        zassert_not_equal(adc_hr_set_period(HR_ODD_PERIOD_US), HR_ODD_PERIOD_US, "period not rounded");
+    }
+    zassert_equal(adc_hr_set_period(0), 0);
+    hr_run_blocks(HR_ODD_PERIOD_US);
+}
+
+ZTEST_SUITE(adc_hr, NULL, hr_setup, NULL, hr_after, NULL);
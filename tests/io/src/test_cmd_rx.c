@@ -0,0 +1,224 @@
+/**
+ * \file test_cmd_rx.c
+ * 
+ * \brief Command frame parser tests
+ * 
+ * cmd_rx() fed directly with frames split at every byte, oversize frames, more frames than the
+ * queue holds and pseudo-random bytes, checking the frames recovered and cmd_dropped(); then the
+ * throughput of frames sent through the UART emulator, the UART callback of the application and
+ * its command thread (GMTjob).
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include <string.h>
+#include "fixture.h"
+#include "bench.h"
+#include "GMTcmd.h"
+
+#define RX_FUZZ_FRAMES 2000 /**< Valid frames hidden in noise by the fuzz test */
+#define RX_FUZZ_BYTES 100000 /**< Random bytes of the fuzz test */
+#define RX_BURSTS 200 /**< Bursts of CMD_QUEUE_LEN frames of the throughput test */
+
+static uint32_t rx_rand_state;
+
+/* xorshift32: the same bytes on every run */
+static uint32_t rx_rand(void)
+{
+    rx_rand_state ^= rx_rand_state << 13;
+    rx_rand_state ^= rx_rand_state >> 17;
+    rx_rand_state ^= rx_rand_state << 5;
+    return rx_rand_state;
+}
+
+/* Feeds len bytes to the parser in chunks of 1 to max_chunk bytes */
+static void rx_feed(const uint8_t *buf, size_t len, size_t max_chunk)
+{
+    while (len > 0) {
+        const size_t n = MIN(len, 1 + rx_rand() % max_chunk);
+
+        cmd_rx(buf, n);
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Checks that the next queued frame has the body str */
+static void rx_expect(const char *str)
+{
+    struct cmd_frame frame;
+
+    zassert_ok(cmd_get(&frame, K_NO_WAIT), "no frame for \"%s\"", str);
+    zassert_equal(frame.len, strlen(str), "\"%s\": length %u", str, frame.len);
+    zassert_mem_equal(frame.str, str, frame.len);
+}
+
+static void rx_drain(void)
+{
+    struct cmd_frame frame;
+
+    while (cmd_get(&frame, K_NO_WAIT) == 0) {
+    }
+}
+
+static void *rx_setup(void)
+{
+    fixture_init();
+    return NULL;
+}
+
+static void rx_before(void *f)
+{
+    /* An empty frame leaves the parser between frames, the queue is emptied */
+    cmd_rx((const uint8_t *)"$&", 2);
+    rx_drain();
+    rx_rand_state = 0x5e7a10;
+}
+
+static void rx_after(void *f)
+{
+    fixture_pipeline_stop();
+    rx_drain();
+}
+
+ZTEST(cmd_rx, test_rx_split)
+{
+    static const char frame[] = "\r\n$TI0123&\r\n";
+    const size_t len = strlen(frame);
+
+    /* Two chunks, split at every position */
+    for (size_t cut = 0; cut <= len; cut++) {
+        cmd_rx((const uint8_t *)frame, cut);
+        cmd_rx((const uint8_t *)&frame[cut], len - cut);
+        rx_expect("TI0123");
+    }
+    /* One byte at a time */
+    for (size_t i = 0; i < len; i++) {
+        cmd_rx((const uint8_t *)&frame[i], 1);
+    }
+    rx_expect("TI0123");
+}
+
+ZTEST(cmd_rx, test_rx_oversize)
+{
+    static uint8_t buf[CMD_MAX_LEN + 3];
+    const uint32_t dropped = cmd_dropped();
+
+    /* CMD_MAX_LEN characters fit */
+    buf[0] = SOF_SYM;
+    memset(&buf[1], 'A', CMD_MAX_LEN);
+    buf[CMD_MAX_LEN + 1] = EOF_SYM;
+    cmd_rx(buf, CMD_MAX_LEN + 2);
+    struct cmd_frame frame;
+
+    zassert_ok(cmd_get(&frame, K_NO_WAIT));
+    zassert_equal(frame.len, CMD_MAX_LEN);
+    zassert_equal(cmd_dropped(), dropped);
+
+    /* One more is dropped, and so is everything up to the next start of frame */
+    memset(&buf[1], 'A', CMD_MAX_LEN + 1);
+    buf[CMD_MAX_LEN + 2] = EOF_SYM;
+    cmd_rx(buf, CMD_MAX_LEN + 3);
+    zassert_equal(cmd_get(&frame, K_NO_WAIT), -ENOMSG);
+    zassert_equal(cmd_dropped(), dropped + 1);
+
+    cmd_rx((const uint8_t *)"$S&", 3);
+    rx_expect("S");
+}
+
+ZTEST(cmd_rx, test_rx_queue_full)
+{
+    const uint32_t dropped = cmd_dropped();
+    struct cmd_frame frame;
+
+    /* Back to back, one frame more than the queue holds: the last one is dropped */
+    cmd_rx((const uint8_t *)"$A&$B&$C&$D&$E&", 15);
+    zassert_equal(cmd_dropped(), dropped + 1);
+    rx_expect("A");
+    rx_expect("B");
+    rx_expect("C");
+    rx_expect("D");
+    zassert_equal(cmd_get(&frame, K_NO_WAIT), -ENOMSG);
+
+    /* An unfinished frame is dropped silently by the next start of frame */
+    cmd_rx((const uint8_t *)"$TI01$TI0200&", 13);
+    rx_expect("TI0200");
+    zassert_equal(cmd_dropped(), dropped + 1);
+}
+
+ZTEST(cmd_rx, test_rx_fuzz)
+{
+    static uint8_t buf[RX_FUZZ_BYTES];
+    const uint32_t dropped = cmd_dropped();
+    struct cmd_frame frame;
+    char body[8];
+
+    /* Valid frames in noise without start of frame: all of them are recovered, none dropped */
+    for (int k = 0; k < RX_FUZZ_FRAMES; k++) {
+        size_t n = rx_rand() % 32;
+
+        for (size_t j = 0; j < n; j++) {
+            do {
+                buf[j] = rx_rand();
+            } while (buf[j] == SOF_SYM);
+        }
+        n += snprintk((char *)&buf[n], sizeof(buf) - n, "$TI%04u&", k % 10000);
+        rx_feed(buf, n, 16);
+        snprintk(body, sizeof(body), "TI%04u", k % 10000);
+        rx_expect(body);
+        zassert_equal(cmd_get(&frame, K_NO_WAIT), -ENOMSG, "extra frame after %d", k);
+    }
+    zassert_equal(cmd_dropped(), dropped);
+
+    /* Random bytes, start and end of frame frequent: every frame queued is well formed */
+    for (size_t j = 0; j < sizeof(buf); j++) {
+        const uint32_t r = rx_rand();
+
+        buf[j] = (r % 8 == 0) ? SOF_SYM : (r % 8 == 1) ? EOF_SYM : (uint8_t)(r >> 8);
+    }
+    for (size_t off = 0; off < sizeof(buf); off += 256) {
+        rx_feed(&buf[off], MIN(256, sizeof(buf) - off), 64);
+        while (cmd_get(&frame, K_NO_WAIT) == 0) {
+            zassert_true(frame.len <= CMD_MAX_LEN);
+            zassert_is_null(memchr(frame.str, SOF_SYM, frame.len));
+            zassert_is_null(memchr(frame.str, EOF_SYM, frame.len));
+        }
+    }
+
+    /* The parser recovers on the next start of frame */
+    cmd_rx((const uint8_t *)"$TI0100&", 8);
+    rx_expect("TI0100");
+}
+
+ZTEST(cmd_rx, test_rx_throughput)
+{
+    static const char burst[] = "$Z0&$Z1&$Z2&$Z3&";
+    const uint32_t dropped = cmd_dropped();
+    struct fixture_cmd_done done;
+    struct bench b;
+
+    BUILD_ASSERT(CMD_QUEUE_LEN == 4, "one burst fills the queue");
+    fixture_pipeline_start();
+    bench_init(&b, "uart_rx_burst_16B");
+    for (int k = 0; k < RX_BURSTS; k++) {
+        const uint64_t t0 = bench_now();
+
+        fixture_send(burst);
+        for (int j = 0; j < CMD_QUEUE_LEN; j++) {
+            zassert_ok(fixture_cmd_wait(&done, K_MSEC(100)), "burst %d: frame %d not processed", k, j);
+        }
+        bench_add(&b, bench_now() - t0);
+    }
+    bench_report(&b);
+    if (b.sum > 0) {
+        printk("uart rx: %llu bytes/s\n", (unsigned long long)(strlen(burst) * NSEC_PER_SEC * b.n / b.sum));
+    }
+    zassert_equal(cmd_dropped(), dropped);
+}
+
+ZTEST_SUITE(cmd_rx, NULL, rx_setup, rx_before, rx_after, NULL);
@@ -0,0 +1,135 @@
+/**
+ * \file test_convert.c
+ * 
+ * \brief Raw to mV conversion tests
+ * 
+ * adc_convert_block() against the division it replaces, for every code, through strided
+ * (interleaved) blocks and with a channel calibration, and the time of both per block of every code.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include "fixture.h"
+#include "bench.h"
+#include "GMTadc.h"
+
+#define CONVERT_CODES (ADC_MAX_CODE + 1) /**< Every code once */
+
+static uint16_t convert_raw[CONVERT_CODES * NUM_CHANNELS];
+static uint16_t convert_mv[CONVERT_CODES];
+
+/* The conversion adc_convert_block() replaces */
+static uint16_t convert_ref(uint32_t code)
+{
+    return ADC_FULL_SCALE_MV * code / ADC_MAX_CODE;
+}
+
+static void *convert_setup(void)
+{
+    fixture_init();
+    return NULL;
+}
+
+static void convert_after(void *fixture)
+{
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        adc_set_calibration(i, ADC_CAL_GAIN_ONE, 0);
+    }
+}
+
+ZTEST(convert, test_convert_every_code)
+{
+    for (uint32_t code = 0; code < CONVERT_CODES; code++) {
+        convert_raw[code] = code;
+    }
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        adc_convert_block(i, convert_raw, 1, convert_mv, CONVERT_CODES);
+        for (uint32_t code = 0; code < CONVERT_CODES; code++) {
+            zassert_equal(convert_mv[code], convert_ref(code), "channel %d, code %u: %u mV", i, code,
+                          convert_mv[code]);
+        }
+    }
+    zassert_equal(convert_mv[ADC_MAX_CODE], ADC_FULL_SCALE_MV);
+}
+
+ZTEST(convert, test_convert_stride)
+{
+    /* Interleaved scans: channel i of scan j at j * NUM_CHANNELS + i, a different code per channel */
+    for (uint32_t j = 0; j < CONVERT_CODES; j++) {
+        for (int i = 0; i < NUM_CHANNELS; i++) {
+            convert_raw[j * NUM_CHANNELS + i] = (j + 257 * i) % CONVERT_CODES;
+        }
+    }
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        adc_convert_block(i, &convert_raw[i], NUM_CHANNELS, convert_mv, CONVERT_CODES);
+        for (uint32_t j = 0; j < CONVERT_CODES; j++) {
+            zassert_equal(convert_mv[j], convert_ref((j + 257 * i) % CONVERT_CODES), "channel %d, scan %u", i, j);
+        }
+    }
+}
+
+ZTEST(convert, test_convert_calibration)
+{
+    for (uint32_t code = 0; code < CONVERT_CODES; code++) {
+        convert_raw[code] = code;
+    }
+
+    /* Offset alone: shifted, saturated at 0 */
+    zassert_ok(adc_set_calibration(1, ADC_CAL_GAIN_ONE, -100));
+    adc_convert_block(1, convert_raw, 1, convert_mv, CONVERT_CODES);
+    for (uint32_t code = 0; code < CONVERT_CODES; code++) {
+        const int32_t ref = (int32_t)convert_ref(code) - 100;
+
+        zassert_equal(convert_mv[code], MAX(ref, 0), "code %u", code);
+    }
+
+    /* Gain of 2: within 1 mV of twice the nominal value (both are truncated) */
+    zassert_ok(adc_set_calibration(2, 2 * ADC_CAL_GAIN_ONE, 0));
+    adc_convert_block(2, convert_raw, 1, convert_mv, CONVERT_CODES);
+    for (uint32_t code = 0; code < CONVERT_CODES; code++) {
+        const uint32_t ref = ADC_FULL_SCALE_MV * 2 * code / ADC_MAX_CODE;
+
+        zassert_true(convert_mv[code] <= ref && convert_mv[code] + 1 >= ref, "code %u: %u mV, %u expected",
+                     code, convert_mv[code], ref);
+    }
+
+    /* Other channels keep the nominal conversion */
+    adc_convert_block(0, convert_raw, 1, convert_mv, CONVERT_CODES);
+    zassert_equal(convert_mv[ADC_MAX_CODE], ADC_FULL_SCALE_MV);
+
+    zassert_equal(adc_set_calibration(-1, ADC_CAL_GAIN_ONE, 0), -EINVAL);
+    zassert_equal(adc_set_calibration(NUM_CHANNELS, ADC_CAL_GAIN_ONE, 0), -EINVAL);
+}
+
+ZTEST(convert, test_convert_time)
+{
+    volatile uint32_t full_scale = ADC_FULL_SCALE_MV; /* keeps the division a division */
+    struct bench div, mult;
+
+    for (uint32_t code = 0; code < CONVERT_CODES; code++) {
+        convert_raw[code] = code;
+    }
+    bench_init(&div, "convert_div_1024");
+    bench_init(&mult, "convert_mult_1024");
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        uint64_t t0 = bench_now();
+
+        for (uint32_t code = 0; code < CONVERT_CODES; code++) {
+            convert_mv[code] = full_scale * convert_raw[code] / ADC_MAX_CODE;
+        }
+        bench_add(&div, bench_now() - t0);
+
+        t0 = bench_now();
+        adc_convert_block(0, convert_raw, 1, convert_mv, CONVERT_CODES);
+        bench_add(&mult, bench_now() - t0);
+    }
+    bench_report(&div);
+    bench_report(&mult);
+}
+
+ZTEST_SUITE(convert, NULL, convert_setup, NULL, convert_after, NULL);
@@ -0,0 +1,236 @@
+/**
+ * \file test_dsp.c
+ * 
+ * \brief Filter stage tests
+ * 
+ * Each filter kernel of GMTdsp against a plain reference, over blocks split at arbitrary points
+ * and interleaved (strided) input, and the time of each kernel per block.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include <stdlib.h>
+#include "fixture.h"
+#include "bench.h"
+#include "GMTadc.h"
+#include "GMTdsp.h"
+
+#define DSP_CH 3 /**< Channel whose filter the tests select */
+#define DSP_SAMPLES 1024 /**< Samples of each test signal */
+
+static uint16_t dsp_in[DSP_SAMPLES * NUM_CHANNELS];
+static uint16_t dsp_out[DSP_SAMPLES];
+static uint32_t dsp_rand_state;
+
+/* xorshift32: the same signal on every run */
+static uint32_t dsp_rand(void)
+{
+    dsp_rand_state ^= dsp_rand_state << 13;
+    dsp_rand_state ^= dsp_rand_state >> 17;
+    dsp_rand_state ^= dsp_rand_state << 5;
+    return dsp_rand_state;
+}
+
+/* Random codes in the input of channel DSP_CH, interleaved with the other channels */
+static void dsp_signal(void)
+{
+    for (int j = 0; j < DSP_SAMPLES * NUM_CHANNELS; j++) {
+        dsp_in[j] = dsp_rand() % (ADC_MAX_CODE + 1);
+    }
+}
+
+static uint16_t dsp_sample(int j)
+{
+    return dsp_in[j * NUM_CHANNELS + DSP_CH];
+}
+
+/* Selects a filter, as the command thread does, and applies it, as the acquisition context does */
+static void dsp_select(enum dsp_filter type, int param)
+{
+    zassert_ok(dsp_set(DSP_CH, type, param));
+    dsp_decimation(DSP_CH);
+}
+
+/* Filters the signal in blocks of pseudo-random lengths; returns the number of outputs */
+static size_t dsp_run_blocks(void)
+{
+    size_t m = 0;
+
+    for (int j = 0; j < DSP_SAMPLES;) {
+        const int n = MIN(DSP_SAMPLES - j, 1 + (int)(dsp_rand() % 40));
+
+        dsp_decimation(DSP_CH);
+        m += dsp_process(DSP_CH, &dsp_in[j * NUM_CHANNELS + DSP_CH], NUM_CHANNELS, &dsp_out[m], n);
+        j += n;
+    }
+    return m;
+}
+
+static int dsp_cmp(const void *a, const void *b)
+{
+    return *(const uint16_t *)a - *(const uint16_t *)b;
+}
+
+static void *dsp_setup(void)
+{
+    fixture_init();
+    return NULL;
+}
+
+static void dsp_before(void *f)
+{
+    dsp_rand_state = 0xd5b;
+    dsp_signal();
+}
+
+static void dsp_after(void *f)
+{
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        dsp_set(i, DSP_NONE, 0);
+        dsp_decimation(i);
+    }
+}
+
+ZTEST(dsp, test_dsp_set_rejects)
+{
+    zassert_equal(dsp_set(-1, DSP_NONE, 0), -EINVAL);
+    zassert_equal(dsp_set(NUM_CHANNELS, DSP_NONE, 0), -EINVAL);
+    zassert_equal(dsp_set(DSP_CH, DSP_BOXCAR, 0), -EINVAL);
+    zassert_equal(dsp_set(DSP_CH, DSP_BOXCAR, DSP_BOXCAR_MAX + 1), -EINVAL);
+    zassert_equal(dsp_set(DSP_CH, DSP_IIR, 0), -EINVAL);
+    zassert_equal(dsp_set(DSP_CH, DSP_IIR, DSP_IIR_SHIFT_MAX + 1), -EINVAL);
+    zassert_equal(dsp_set(DSP_CH, DSP_MEDIAN, 4), -EINVAL);
+    zassert_equal(dsp_set(DSP_CH, DSP_MEDIAN + 1, 1), -EINVAL);
+}
+
+ZTEST(dsp, test_dsp_none)
+{
+    dsp_select(DSP_NONE, 0);
+    zassert_equal(dsp_run_blocks(), DSP_SAMPLES);
+    for (int j = 0; j < DSP_SAMPLES; j++) {
+        zassert_equal(dsp_out[j], dsp_sample(j), "sample %d", j);
+    }
+}
+
+ZTEST(dsp, test_dsp_boxcar)
+{
+    static const int factors[] = {1, 3, 8, DSP_BOXCAR_MAX};
+
+    for (int f = 0; f < ARRAY_SIZE(factors); f++) {
+        const int d = factors[f];
+        size_t m;
+
+        dsp_select(DSP_BOXCAR, d);
+        zassert_equal(dsp_decimation(DSP_CH), d);
+        m = dsp_run_blocks();
+        /* Groups span the blocks: one output per complete group, the rest is pending */
+        zassert_equal(m, DSP_SAMPLES / d, "factor %d", d);
+        zassert_equal(dsp_pending(DSP_CH), DSP_SAMPLES % d, "factor %d", d);
+        for (size_t k = 0; k < m; k++) {
+            uint32_t sum = 0;
+
+            for (int j = 0; j < d; j++) {
+                sum += dsp_sample(k * d + j);
+            }
+            zassert_equal(dsp_out[k], (sum + d / 2) / d, "factor %d, output %zu", d, k);
+        }
+    }
+}
+
+ZTEST(dsp, test_dsp_iir)
+{
+    for (int shift = 1; shift <= DSP_IIR_SHIFT_MAX; shift++) {
+        double y;
+
+        dsp_select(DSP_IIR, shift);
+        zassert_equal(dsp_run_blocks(), DSP_SAMPLES);
+        /* Starts from the first sample; then within one code of the exact filter */
+        y = dsp_sample(0);
+        for (int j = 0; j < DSP_SAMPLES; j++) {
+            y += (dsp_sample(j) - y) / (1 << shift);
+            zassert_within(dsp_out[j], y, 1.0, "shift %d, sample %d: %u, %f expected", shift, j,
+                           dsp_out[j], y);
+        }
+    }
+
+    /* A step settles on its value */
+    for (int j = 0; j < DSP_SAMPLES; j++) {
+        dsp_in[j * NUM_CHANNELS + DSP_CH] = (j < 8) ? 0 : ADC_MAX_CODE;
+    }
+    dsp_select(DSP_IIR, 4);
+    dsp_run_blocks();
+    zassert_equal(dsp_out[DSP_SAMPLES - 1], ADC_MAX_CODE);
+}
+
+ZTEST(dsp, test_dsp_median)
+{
+    static const int windows[] = {3, 5};
+
+    for (int w = 0; w < ARRAY_SIZE(windows); w++) {
+        const int len = windows[w];
+
+        dsp_select(DSP_MEDIAN, len);
+        zassert_equal(dsp_run_blocks(), DSP_SAMPLES);
+        /* Until the window is full, the newest sample */
+        for (int j = 0; j < len - 1; j++) {
+            zassert_equal(dsp_out[j], dsp_sample(j), "window %d, sample %d", len, j);
+        }
+        for (int j = len - 1; j < DSP_SAMPLES; j++) {
+            uint16_t win[DSP_MEDIAN_MAX];
+
+            for (int k = 0; k < len; k++) {
+                win[k] = dsp_sample(j - len + 1 + k);
+            }
+            qsort(win, len, sizeof(win[0]), dsp_cmp);
+            zassert_equal(dsp_out[j], win[len / 2], "window %d, sample %d", len, j);
+        }
+    }
+
+    /* A single-sample glitch on a flat signal never reaches the output */
+    for (int j = 0; j < DSP_SAMPLES; j++) {
+        dsp_in[j * NUM_CHANNELS + DSP_CH] = (j % 7 == 3) ? ADC_MAX_CODE : 100;
+    }
+    dsp_select(DSP_MEDIAN, 3);
+    dsp_run_blocks();
+    for (int j = 2; j < DSP_SAMPLES; j++) {
+        zassert_equal(dsp_out[j], 100, "sample %d", j);
+    }
+}
+
+ZTEST(dsp, test_dsp_time)
+{
+    static const struct {
+        const char *name;
+        enum dsp_filter type;
+        int param;
+    } kernels[] = {
+        {"dsp_none_1024", DSP_NONE, 0},
+        {"dsp_boxcar8_1024", DSP_BOXCAR, 8},
+        {"dsp_iir4_1024", DSP_IIR, 4},
+        {"dsp_median3_1024", DSP_MEDIAN, 3},
+        {"dsp_median5_1024", DSP_MEDIAN, 5},
+    };
+
+    for (int f = 0; f < ARRAY_SIZE(kernels); f++) {
+        struct bench b;
+
+        dsp_select(kernels[f].type, kernels[f].param);
+        bench_init(&b, kernels[f].name);
+        for (int k = 0; k < BENCH_RUNS; k++) {
+            uint64_t t0;
+
+            dsp_decimation(DSP_CH);
+            t0 = bench_now();
+            dsp_process(DSP_CH, &dsp_in[DSP_CH], NUM_CHANNELS, dsp_out, DSP_SAMPLES);
+            bench_add(&b, bench_now() - t0);
+        }
+        bench_report(&b);
+    }
+}
+
+ZTEST_SUITE(dsp, NULL, dsp_setup, dsp_before, dsp_after, NULL);
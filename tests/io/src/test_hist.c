@@ -0,0 +1,212 @@
+/**
+ * \file test_hist.c
+ *
+ * \brief Compressed history tests
+ *
+ * The GMThist codec against the samples pushed: round trip across block boundaries and ring wraps,
+ * with raw deltas and timestamp gaps of every varint length, hist_read() at every age, the
+ * compression ratio over the RTDB rings, and the encode and decode time per sample.
+ *
+ * \version 1.0
+ *
+ * \date 05-07-2023
+ *
+ * \author Gonçalo Tavares
+*/
+
+#include <zephyr/ztest.h>
+#include "fixture.h"
+#include "bench.h"
+#include "GMTadc.h"
+#include "GMThist.h"
+#include "rtdb.h"
+
+#define HIST_CH 2 /**< Channel the tests push to */
+#define HIST_SAMPLES 2000 /**< Samples of the round trip, several ring wraps */
+#define HIST_RING_MAX (HIST_BLOCKS * HIST_BLOCK_MAX_SAMPLES) /**< Most samples the history holds */
+#define HIST_PERIOD_US 1000000 /**< Sampling period of the ratio test (in us) */
+#define HIST_JITTER_US 100 /**< Timestamp jitter of the ratio test (+/- us) */
+#define HIST_NOISE 10 /**< Raw value noise of the ratio test (+/- codes) */
+
+static uint32_t hist_ts[HIST_SAMPLES];
+static uint16_t hist_raw[HIST_SAMPLES];
+static struct adc_ts_sample hist_out[HIST_RING_MAX];
+static uint32_t hist_t; /**< Timestamp of the last sample pushed */
+static uint32_t hist_rand_state;
+
+/* xorshift32: the same signal on every run */
+static uint32_t hist_rand(void)
+{
+    hist_rand_state ^= hist_rand_state << 13;
+    hist_rand_state ^= hist_rand_state >> 17;
+    hist_rand_state ^= hist_rand_state << 5;
+    return hist_rand_state;
+}
+
+/* Decodes every block, oldest first; returns the number of samples */
+static int hist_read_all(void)
+{
+    int total = 0;
+
+    for (int age = hist_blocks(HIST_CH) - 1; age >= 0; age--) {
+        int n = hist_read(HIST_CH, age, &hist_out[total], HIST_BLOCK_MAX_SAMPLES);
+
+        zassert_true(n > 0, "block %d: %d", age, n);
+        total += n;
+    }
+    return total;
+}
+
+/* Pushes n samples one period apart with jitter and noise around mid-scale */
+static void hist_push_jittered(int n)
+{
+    uint32_t t = hist_t;
+
+    for (int j = 0; j < n; j++) {
+        t += HIST_PERIOD_US + (int)(hist_rand() % (2 * HIST_JITTER_US + 1)) - HIST_JITTER_US;
+        hist_push(HIST_CH, t, ADC_MAX_CODE / 2 + (int)(hist_rand() % (2 * HIST_NOISE + 1)) - HIST_NOISE);
+    }
+    hist_t = t;
+}
+
+static void *hist_setup(void)
+{
+    fixture_init();
+    return NULL;
+}
+
+static void hist_before(void *f)
+{
+    hist_rand_state = 0x2545f491;
+}
+
+ZTEST(hist, test_hist_round_trip)
+{
+    uint32_t t = 1000;
+    int total;
+
+    /* Mostly small steps, with full-scale raw jumps (escaped delta) and timestamp gaps from one
+     * to five varint bytes, some of them going back in time */
+    for (int j = 0; j < HIST_SAMPLES; j++) {
+        const uint32_t r = hist_rand();
+        const int prev = j ? hist_raw[j - 1] : ADC_MAX_CODE / 2;
+
+        if (r % 16 == 0) {
+            hist_raw[j] = (r & BIT(8)) ? ADC_MAX_CODE : 0;
+        }
+        else {
+            hist_raw[j] = CLAMP(prev + (int)((r >> 8) % 41) - 20, 0, ADC_MAX_CODE);
+        }
+        if (r % 16 == 1) {
+            t += r >> (r % 32);
+        }
+        else if (r % 16 == 2) {
+            t -= (r >> 8) % 5000;
+        }
+        else {
+            t += 1000 + (r >> 20) % 64;
+        }
+        hist_ts[j] = t;
+        hist_push(HIST_CH, hist_ts[j], hist_raw[j]);
+    }
+    hist_t = t;
+
+    /* The ring wrapped: every block is ours, the oldest ones dropped whole */
+    zassert_equal(hist_blocks(HIST_CH), HIST_BLOCKS);
+    total = hist_read_all();
+    zassert_true(total > HIST_BLOCKS && total <= HIST_RING_MAX, "%d samples", total);
+    for (int i = 0; i < total; i++) {
+        const int j = HIST_SAMPLES - total + i;
+        uint16_t mv;
+
+        adc_convert_block(HIST_CH, &hist_raw[j], 1, &mv, 1);
+        zassert_equal(hist_out[i].timestamp, hist_ts[j], "sample %d: %u us, pushed %u", j,
+                      hist_out[i].timestamp, hist_ts[j]);
+        zassert_equal(hist_out[i].original_value, hist_raw[j], "sample %d: %u, pushed %u", j,
+                      hist_out[i].original_value, hist_raw[j]);
+        zassert_equal(hist_out[i].converted_value, mv, "sample %d: %u mV", j, hist_out[i].converted_value);
+    }
+}
+
+ZTEST(hist, test_hist_read_ages)
+{
+    struct adc_ts_sample out[HIST_BLOCK_MAX_SAMPLES];
+    uint32_t newer = 0;
+
+    hist_push_jittered(HIST_RING_MAX);
+    zassert_equal(hist_blocks(HIST_CH), HIST_BLOCKS);
+
+    /* Every age decodes; each block starts after the ones older than it ended */
+    for (int age = HIST_BLOCKS - 1; age >= 0; age--) {
+        int n = hist_read(HIST_CH, age, out, ARRAY_SIZE(out));
+
+        zassert_true(n >= 1 && n <= HIST_BLOCK_MAX_SAMPLES, "age %d: %d", age, n);
+        if (age < HIST_BLOCKS - 1) {
+            zassert_true((int32_t)(out[0].timestamp - newer) > 0, "age %d starts at %u us", age,
+                         out[0].timestamp);
+        }
+        newer = out[n - 1].timestamp;
+        /* A shorter destination stops the decode there */
+        zassert_equal(hist_read(HIST_CH, age, out, 1), 1, "age %d", age);
+    }
+
+    zassert_equal(hist_read(HIST_CH, HIST_BLOCKS, out, ARRAY_SIZE(out)), -EINVAL);
+    zassert_equal(hist_read(HIST_CH, -1, out, ARRAY_SIZE(out)), -EINVAL);
+    zassert_equal(hist_read(HIST_CH, 0, out, 0), -EINVAL);
+    zassert_equal(hist_read(-1, 0, out, ARRAY_SIZE(out)), -EINVAL);
+    zassert_equal(hist_read(NUM_CHANNELS, 0, out, ARRAY_SIZE(out)), -EINVAL);
+    zassert_equal(hist_blocks(NUM_CHANNELS), 0);
+}
+
+/* 1 s period with +/-100 us jitter and +/-10 codes of noise: at least 3 times the samples of
+ * an RTDB ring in the same RAM, at every point of the block cycle */
+ZTEST(hist, test_hist_ratio)
+{
+    struct hist_stats stats;
+
+    hist_push_jittered(HIST_RING_MAX);
+    for (int j = 0; j < HIST_BLOCK_MAX_SAMPLES; j++) {
+        hist_push_jittered(1);
+        zassert_ok(hist_get_stats(HIST_CH, &stats));
+        zassert_equal(stats.bytes, HIST_BLOCKS * HIST_BLOCK_BYTES);
+        zassert_true(stats.samples * sizeof(struct adc_ts_sample) >= 3 * stats.bytes,
+                     "%u samples in %u bytes", stats.samples, stats.bytes);
+    }
+    TC_PRINT("history: %u samples in %u bytes, %u in a ring of %u bytes\n", stats.samples, stats.bytes,
+             (uint32_t)(stats.bytes / sizeof(struct adc_ts_sample)), stats.bytes);
+    zassert_equal(hist_get_stats(NUM_CHANNELS, &stats), -EINVAL);
+}
+
+ZTEST(hist, test_hist_time)
+{
+    struct adc_ts_sample out[HIST_BLOCK_MAX_SAMPLES];
+    uint32_t t = hist_t;
+    struct bench b;
+
+    bench_init(&b, "hist_push");
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        uint64_t t0;
+
+        t += HIST_PERIOD_US + (int)(hist_rand() % (2 * HIST_JITTER_US + 1)) - HIST_JITTER_US;
+        t0 = bench_now();
+        hist_push(HIST_CH, t, ADC_MAX_CODE / 2 + (int)(hist_rand() % (2 * HIST_NOISE + 1)) - HIST_NOISE);
+        bench_add(&b, bench_now() - t0);
+    }
+    bench_report(&b);
+    hist_t = t;
+
+    /* Per sample: a full block decoded, divided by its samples */
+    bench_init(&b, "hist_read_per_sample");
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        const int age = 1 + k % (HIST_BLOCKS - 1);
+        uint64_t t0;
+        int n;
+
+        t0 = bench_now();
+        n = hist_read(HIST_CH, age, out, ARRAY_SIZE(out));
+        bench_add(&b, (bench_now() - t0) / MAX(n, 1));
+    }
+    bench_report(&b);
+}
+
+ZTEST_SUITE(hist, NULL, hist_setup, hist_before, NULL, NULL);
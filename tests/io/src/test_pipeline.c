@@ -0,0 +1,284 @@
+/**
+ * \file test_pipeline.c
+ * 
+ * \brief Acquisition and command pipeline tests
+ * 
+ * Emulated inputs through adc_collect() to the RTDB, the command return codes and batch staging,
+ * the counters of event-released jobs, and the latency from a command frame on the UART to the
+ * PWM write it causes.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixture.h"
+#include "bench.h"
+#include "GMTadc.h"
+#include "GMTpwm.h"
+#include "GMTcmd.h"
+#include "GMTtask.h"
+#include "GMTjob.h"
+#include "rtdb.h"
+
+#define PIPELINE_E2E_RUNS 100 /**< Command frames timed by the end-to-end test */
+#define PIPELINE_PWM_PERIOD 1 /**< Period of the PWM task during the end-to-end test (in ms) */
+#define PIPELINE_SLOW_PERIOD 500 /**< Period of the PWM task during the on-change test (in ms) */
+
+/* Processes the body of a frame, as the command thread does */
+static int pipeline_cmd(const char *str)
+{
+    struct cmd_frame frame = {.len = strlen(str)};
+
+    memcpy(frame.str, str, frame.len);
+    return cmdProcess(&frame);
+}
+
+static void *pipeline_setup(void)
+{
+    fixture_init();
+    return NULL;
+}
+
+static void pipeline_after(void *f)
+{
+    fixture_pipeline_stop();
+    ptask_set_period(&task_an, 1000);
+    ptask_set_period(&task_pwm, 1000);
+    adc_set_channel_period(0, 0);
+    adc_set_channel_period(1, 0);
+}
+
+ZTEST(pipeline, test_adc_collect_publishes)
+{
+    static const uint32_t mv[NUM_CHANNELS] = {0, 1000, 2000, 2999};
+    struct adc_value_container before, after;
+
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        zassert_ok(fixture_set_input(i, mv[i]));
+    }
+    rtdb_adc_read(&before);
+    zassert_ok(adc_collect());
+    rtdb_adc_read(&after);
+
+    zassert_equal(after.seq, before.seq + 1, "one snapshot per collect");
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        zassert_true(after.original_values[i] <= ADC_MAX_CODE, "channel %d out of range", i);
+        zassert_within(after.converted_values[i], mv[i], FIXTURE_ADC_TOL_MV, "channel %d", i);
+        zassert_equal(after.channel_timestamps[i], after.timestamp, "channel %d", i);
+    }
+}
+
+/* However many plans are committed between two collects, the last one starts at its first tick */
+ZTEST(pipeline, test_adc_plan_commits)
+{
+    struct adc_value_container snapshot;
+
+    /* Tick of 1 ms, channel 1 due on every other tick */
+    zassert_equal(adc_set_channel_period(0, 1), 1);
+    zassert_equal(adc_set_channel_period(1, 2), 1);
+    zassert_ok(adc_collect());
+    zassert_equal(adc_set_channel_period(1, 2), 1);
+    zassert_equal(adc_set_channel_period(1, 2), 1);
+    k_sleep(K_MSEC(1));
+    zassert_ok(adc_collect());
+    rtdb_adc_read(&snapshot);
+    zassert_equal(snapshot.channel_timestamps[1], snapshot.timestamp, "channel 1 not due on the first tick");
+}
+
+ZTEST(pipeline, test_rtdb_roundtrip)
+{
+    struct adc_value_container in = {0}, out;
+    uint32_t seq;
+
+    rtdb_adc_read(&out);
+    seq = out.seq;
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        in.original_values[i] = 100 * i;
+        in.converted_values[i] = 1000 + i;
+        in.channel_timestamps[i] = 42;
+    }
+    in.timestamp = 42;
+    in.seq = 12345;         /* ignored, the RTDB numbers the snapshots */
+    rtdb_adc_write(&in);
+    rtdb_adc_read(&out);
+
+    zassert_equal(out.seq, seq + 1);
+    zassert_equal(out.timestamp, 42);
+    zassert_mem_equal(out.original_values, in.original_values, sizeof(in.original_values));
+    zassert_mem_equal(out.converted_values, in.converted_values, sizeof(in.converted_values));
+}
+
+ZTEST(pipeline, test_cmd_return_codes)
+{
+    char setpoint[8];
+
+    zassert_equal(pipeline_cmd(""), -1, "empty frame");
+    zassert_equal(pipeline_cmd("Z1"), -2, "unknown command");
+    zassert_equal(pipeline_cmd("1TI"), -2, "not a command letter");
+    zassert_equal(pipeline_cmd("TI12"), -2, "short period");
+    zassert_equal(pipeline_cmd("TI01a0"), -2, "not a digit");
+    zassert_equal(pipeline_cmd("TI0000"), -4, "period out of range");
+
+    zassert_equal(pipeline_cmd("TI0100"), 0);
+    zassert_equal(task_an.period, 100);
+    zassert_equal(pipeline_cmd("to0250"), 0, "lower case");
+    zassert_equal(task_pwm.period, 250);
+
+    /* The setpoint has the range of the batch setting CS= */
+    snprintf(setpoint, sizeof(setpoint), "CS%04d", ADC_FULL_SCALE_MV + 1);
+    zassert_equal(pipeline_cmd(setpoint), -2, "setpoint above full scale");
+    snprintf(setpoint, sizeof(setpoint), "CS%04d", ADC_FULL_SCALE_MV);
+    zassert_equal(pipeline_cmd(setpoint), 0);
+    zassert_equal(pipeline_cmd("CS1500"), 0);
+
+    /* Four digits for S, P, I and D, none for X and L: an empty field is not a zero */
+    zassert_equal(pipeline_cmd("CS"), -2, "empty setpoint");
+    zassert_equal(pipeline_cmd("CP"), -2, "empty gain");
+    zassert_equal(pipeline_cmd("CI"), -2, "empty gain");
+    zassert_equal(pipeline_cmd("CD"), -2, "empty gain");
+    zassert_equal(pipeline_cmd("CP12"), -2, "short gain");
+    zassert_equal(pipeline_cmd("CE"), -2, "no channel");
+    zassert_equal(pipeline_cmd("CX123"), -2, "digits after X");
+    zassert_equal(pipeline_cmd("CL99"), -2, "digits after L");
+    zassert_equal(pipeline_cmd("CX"), 0);
+    zassert_equal(pipeline_cmd("CL"), 0);
+}
+
+ZTEST(pipeline, test_cmd_batch_staged)
+{
+    zassert_equal(pipeline_cmd("TI=0200,TI=0300"), -3, "key given twice");
+    zassert_equal(pipeline_cmd("TI=0200,XX=0001"), -2, "unknown key");
+    zassert_equal(pipeline_cmd("TI=0200,"), -3, "empty last setting");
+    zassert_equal(pipeline_cmd("TI=0200,,TO=0400"), -3, "empty setting");
+
+    zassert_equal(pipeline_cmd("TI=0200,TO=0400"), 0);
+    zassert_equal(pipeline_cmd("CS=1000"), -5, "previous batch not applied");
+    zassert_equal(task_an.period, 1000, "applied before the cycle boundary");
+
+    cmd_commit();
+    zassert_equal(task_an.period, 200);
+    zassert_equal(task_pwm.period, 400);
+    zassert_equal(pipeline_cmd("CS=1000"), 0, "next batch accepted");
+    cmd_commit();
+}
+
+/* Jobs released by an event are counted like periodic ones: jobs, release jitter, response
+ * time and a deadline one period after the event */
+ZTEST(pipeline, test_ptask_event_jobs)
+{
+    static struct ptask ev;
+    const int64_t late = k_ms_to_ticks_ceil64(200);
+
+    ptask_init(&ev, "event", 100, PTASK_SKIP);
+    ptask_start(&ev);
+    ptask_event_end(&ev);
+    zassert_equal(ev.jobs, 1);
+    zassert_equal(ev.exec_count, 1);
+    zassert_equal(ev.missed, 0);
+
+    /* Started 200 ms after its event: two periods late */
+    ptask_event_begin(&ev, k_uptime_ticks() - late);
+    zassert_true(ev.jitter_last >= k_ticks_to_us_floor64(late), "jitter %u us", ev.jitter_last);
+    ptask_event_end(&ev);
+    zassert_equal(ev.jobs, 2);
+    zassert_equal(ev.exec_count, 2);
+    zassert_equal(ev.missed, 1);
+    zassert_true(ev.response_max >= k_ticks_to_us_floor64(late), "response %u us", ev.response_max);
+
+    /* No period: left out of the schedulability test of the other tests */
+    ptask_set_period(&ev, 0);
+}
+
+/* The statistics frame of a task with every counter at its widest fits PTASK_REPORT_SIZE, and a
+ * truncated frame still ends with '&' */
+ZTEST(pipeline, test_ptask_report_frame)
+{
+    static struct ptask wide;
+    static char buf[PTASK_REPORT_SIZE];
+    int len;
+
+    ptask_init(&wide, "a_name_longer_than_the_report_keeps", 0, PTASK_SKIP);
+    wide.jobs = wide.missed = wide.skipped = UINT32_MAX;
+    wide.jitter_max = wide.response_max = UINT32_MAX;
+    for (int b = 0; b < PTASK_HIST_BUCKETS; b++) {
+        wide.exec_hist[b] = UINT32_MAX;
+    }
+
+    len = ptask_report(buf, sizeof(buf));
+    zassert_equal(len, strlen(buf));
+    zassert_true(len < sizeof(buf) - 1, "%d bytes, not truncated", len);
+    zassert_equal(buf[len - 1], '&');
+    zassert_not_null(strstr(buf, ";a_name_longer_th,4294967295,"), "name cut to PTASK_NAME_MAX");
+
+    len = ptask_report(buf, 40);
+    zassert_equal(len, 39);
+    zassert_equal(len, strlen(buf));
+    zassert_equal(buf[len - 1], '&');
+}
+
+/* $PMOC& on the UART to the write of output O by the next PWM job, in kernel time: the frame
+ * parser, the command thread and the wait for the PWM release */
+ZTEST(pipeline, test_cmd_to_pwm_latency)
+{
+    struct fixture_pwm_write write;
+    struct bench b;
+
+    zassert_ok(fixture_set_input(1, 1500));
+    zassert_ok(fixture_set_input(2, 600));
+    zassert_ok(adc_collect());
+    ptask_set_period(&task_pwm, PIPELINE_PWM_PERIOD);
+    fixture_pipeline_start();
+
+    bench_init(&b, "cmd_to_pwm");
+    for (int k = 0; k < PIPELINE_E2E_RUNS; k++) {
+        /* Output 1 follows input 1 and 2 in turn, so every frame changes it */
+        const uint32_t t0 = k_cycle_get_32();
+
+        fixture_send((k & 1) ? "$PM12&" : "$PM11&");
+        zassert_ok(fixture_pwm_wait(1, &write, K_MSEC(100)), "no PWM write for frame %d", k);
+        zassert_equal(fixture_cmd_result(), 0);
+        bench_add(&b, k_cyc_to_ns_floor64((uint32_t)(write.cycle - t0)));
+    }
+    bench_report(&b);
+
+    /* At most one PWM period, plus the command path */
+    zassert_true(b.max < 2 * PIPELINE_PWM_PERIOD * NSEC_PER_MSEC, "worst latency %llu ns", (unsigned long long)b.max);
+}
+
+/* The PWM thread of the application with PWM_ON_CHANGE: once an output is mapped, a new snapshot
+ * that moves its input by PWM_CHANGE_MV releases a job at once, far before the PWM period; a
+ * smaller move releases none */
+ZTEST(pipeline, test_pwm_on_change)
+{
+    struct fixture_pwm_write write;
+
+    if (!PWM_ON_CHANGE) {
+        ztest_test_skip();
+    }
+    zassert_ok(fixture_set_input(1, 1000));
+    zassert_ok(adc_collect());
+    ptask_set_period(&task_pwm, PIPELINE_SLOW_PERIOD);
+    fixture_pipeline_start();
+
+    /* Applied by the next job on the release grid */
+    fixture_send("$PM11&");
+    zassert_ok(fixture_pwm_wait(1, &write, K_MSEC(2 * PIPELINE_SLOW_PERIOD)), "mapping not applied");
+    zassert_equal(fixture_cmd_result(), 0);
+
+    zassert_ok(fixture_set_input(1, 2000));
+    zassert_ok(adc_collect());
+    zassert_ok(fixture_pwm_wait(1, &write, K_MSEC(PIPELINE_SLOW_PERIOD / 10)), "no job on the change");
+
+    zassert_ok(fixture_set_input(1, 2000 + PWM_CHANGE_MV / 3));
+    zassert_ok(adc_collect());
+    zassert_equal(fixture_pwm_wait(1, &write, K_MSEC(PIPELINE_SLOW_PERIOD / 10)), -EAGAIN,
+                  "job on a change below PWM_CHANGE_MV");
+}
+
+ZTEST_SUITE(pipeline, NULL, pipeline_setup, NULL, pipeline_after, NULL);
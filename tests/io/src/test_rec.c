@@ -0,0 +1,154 @@
+/**
+ * \file test_rec.c
+ * 
+ * \brief Flash recorder tests
+ * 
+ * GMTrec on the flash simulator of native_sim (setr.io.recorder, rec.conf): snapshots published
+ * and collected one by one, the time of a chunk write, the write amplification
+ * (flash_bytes / payload_bytes), the dump and the erase, and the recording across sector rotations.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include "fixture.h"
+#include "bench.h"
+#include "GMTrec.h"
+#include "rtdb.h"
+
+#if REC_ENABLE
+
+#define REC_TEST_MAX_AMP_PERMILLE 1020 /**< Highest accepted write amplification (per mille) */
+
+static uint32_t rec_test_ts; /**< Channel timestamp of the last snapshot published */
+
+/* Publishes n snapshots, each with a new sample of every channel, and records each of them;
+ * collects that write a chunk are timed in chunk, the others in collect (either may be NULL) */
+static void rec_publish(uint32_t n, struct bench *collect, struct bench *chunk)
+{
+    struct adc_value_container snapshot;
+    struct rec_stats stats;
+    uint32_t chunks;
+
+    rec_get_stats(&stats);
+    chunks = stats.chunks;
+    rtdb_adc_read(&snapshot);
+    for (uint32_t k = 0; k < n; k++) {
+        uint64_t t0;
+
+        rec_test_ts++;
+        snapshot.timestamp = rec_test_ts;
+        for (int i = 0; i < NUM_CHANNELS; i++) {
+            snapshot.original_values[i] = (rec_test_ts + i) % (ADC_MAX_CODE + 1);
+            snapshot.channel_timestamps[i] = rec_test_ts;
+        }
+        rtdb_adc_write(&snapshot);
+        t0 = bench_now();
+        zassert_ok(rec_collect(K_NO_WAIT), "snapshot %u not recorded", k);
+        t0 = bench_now() - t0;
+
+        rec_get_stats(&stats);
+        if (stats.chunks != chunks) {
+            chunks = stats.chunks;
+            if (chunk != NULL) {
+                bench_add(chunk, t0);
+            }
+        }
+        else if (collect != NULL) {
+            bench_add(collect, t0);
+        }
+    }
+}
+
+static void *rec_setup(void)
+{
+    fixture_init();
+    zassert_ok(rec_init(), "no recorder on the storage partition");
+    return NULL;
+}
+
+static void rec_before(void *f)
+{
+    /* Snapshots published by other suites are taken, the RAM chunk is written, then all is erased */
+    while (rec_collect(K_NO_WAIT) == 0) {
+    }
+    zassert_ok(rec_flush());
+    zassert_ok(rec_erase());
+}
+
+ZTEST(rec, test_rec_amplification)
+{
+    const uint32_t n = 4 * REC_CHUNK_RECORDS;
+    struct rec_stats before, after;
+    struct bench collect, chunk;
+    uint32_t payload, flash, amp;
+
+    rec_get_stats(&before);
+    bench_init(&collect, "rec_collect");
+    bench_init(&chunk, "rec_chunk_write");
+    rec_publish(n, &collect, &chunk);
+    rec_get_stats(&after);
+    bench_report(&collect);
+    bench_report(&chunk);
+
+    zassert_equal(after.records - before.records, n);
+    zassert_equal(after.dropped, before.dropped, "%u snapshots dropped", after.dropped - before.dropped);
+    zassert_equal(after.chunks - before.chunks, 4);
+    zassert_equal(after.erases, before.erases, "sectors erased with room left");
+
+    payload = after.payload_bytes - before.payload_bytes;
+    flash = after.flash_bytes - before.flash_bytes;
+    zassert_equal(payload, n * REC_RECORD_BYTES);
+    amp = (uint32_t)((uint64_t)flash * 1000 / payload);
+    printk("rec: %u payload bytes, %u flash bytes, amplification %u.%03u, %u us writing", payload, flash,
+           amp / 1000, amp % 1000, after.write_us - before.write_us);
+    if (after.write_us != before.write_us) {
+        printk(", %llu bytes/s", (unsigned long long)payload * USEC_PER_SEC / (after.write_us - before.write_us));
+    }
+    printk("\n");
+    zassert_true(flash >= payload);
+    zassert_true(amp <= REC_TEST_MAX_AMP_PERMILLE, "write amplification %u per mille", amp);
+}
+
+ZTEST(rec, test_rec_dump_erase)
+{
+    const uint32_t n = REC_CHUNK_RECORDS + 10;
+
+    /* One chunk in flash, the rest in RAM: all of them are dumped */
+    rec_publish(n, NULL, NULL);
+    zassert_equal(rec_dump(), n);
+
+    zassert_ok(rec_erase());
+    zassert_equal(rec_dump(), 0);
+
+    /* Recording carries on after an erase */
+    rec_publish(10, NULL, NULL);
+    zassert_equal(rec_dump(), 10);
+}
+
+ZTEST(rec, test_rec_rotation)
+{
+    struct rec_stats before, after;
+    int dumped;
+
+    /* More chunks than the partition holds: the oldest sectors are erased to make room */
+    rec_get_stats(&before);
+    rec_publish((REC_SECTORS_MAX + 2) * REC_CHUNK_RECORDS, NULL, NULL);
+    rec_get_stats(&after);
+    zassert_true(after.erases > before.erases, "no sector erased");
+    zassert_true(after.erase_bytes - before.erase_bytes >= (after.erases - before.erases) * REC_CHUNK_BYTES);
+    zassert_equal(after.dropped, before.dropped);
+
+    /* What is left is dumped: fewer than recorded, several chunks */
+    dumped = rec_dump();
+    zassert_true(dumped >= 2 * REC_CHUNK_RECORDS, "%d snapshots dumped", dumped);
+    zassert_true(dumped < (REC_SECTORS_MAX + 2) * REC_CHUNK_RECORDS, "%d snapshots dumped", dumped);
+}
+
+ZTEST_SUITE(rec, NULL, rec_setup, rec_before, NULL, NULL);
+
+#endif /* REC_ENABLE */
@@ -0,0 +1,154 @@
+/**
+ * \file test_rtdb_stress.c
+ * 
+ * \brief RTDB snapshot stress test
+ * 
+ * One writer publishes snapshots back to back at the lowest priority while three readers of higher
+ * priority wake up and read them. Every field of a published snapshot is derived from one counter,
+ * so a torn copy shows as fields that disagree. Reader and writer latencies are reported with
+ * bench_report(). On qemu_x86 the readers preempt the writer in the middle of a copy and exercise
+ * the retry; on native_sim a thread is only preempted at kernel calls, so the copies interleave
+ * at publication boundaries only.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include <string.h>
+#include "fixture.h"
+#include "bench.h"
+#include "rtdb.h"
+
+#define STRESS_WRITES 20000 /**< Snapshots published by the writer */
+#define STRESS_READERS 3 /**< Reader threads */
+#define STRESS_GAP_US 5 /**< Busy wait of the writer between two publications (in us) */
+#define STRESS_STACKSIZE 2048 /**< Size of each stress thread stack */
+#define STRESS_WRITER_PRIO 7 /**< Priority of the writer, below every reader */
+
+K_THREAD_STACK_DEFINE(stress_writer_stack, STRESS_STACKSIZE);
+K_THREAD_STACK_ARRAY_DEFINE(stress_reader_stack, STRESS_READERS, STRESS_STACKSIZE);
+static struct k_thread stress_writer_data;
+static struct k_thread stress_reader_data[STRESS_READERS];
+
+/** Figures of one reader */
+struct stress_reader {
+    struct bench bench;
+    int prio;
+    uint32_t sleep_us;          /**< Sleep between two reads */
+    uint32_t reads;
+    uint32_t torn;              /**< Snapshots whose fields disagree */
+    uint32_t backwards;         /**< Snapshots older than the previous one read */
+};
+
+static struct stress_reader stress_readers[STRESS_READERS];
+static struct bench stress_writer_bench;
+static atomic_t stress_done;
+
+/* Every field of snapshot c follows from c */
+static void stress_fill(struct adc_value_container *s, uint32_t c)
+{
+    s->timestamp = c;
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        s->original_values[i] = (uint16_t)(c + i);
+        s->converted_values[i] = (uint16_t)(3 * c + i);
+        s->channel_timestamps[i] = c;
+    }
+}
+
+static bool stress_consistent(const struct adc_value_container *s)
+{
+    struct adc_value_container ref;
+
+    stress_fill(&ref, s->timestamp);
+    return memcmp(ref.original_values, s->original_values, sizeof(ref.original_values)) == 0 &&
+           memcmp(ref.converted_values, s->converted_values, sizeof(ref.converted_values)) == 0 &&
+           memcmp(ref.channel_timestamps, s->channel_timestamps, sizeof(ref.channel_timestamps)) == 0;
+}
+
+static void stress_writer_code(void *argA, void *argB, void *argC)
+{
+    struct adc_value_container s;
+
+    for (uint32_t c = 1; c <= STRESS_WRITES; c++) {
+        uint64_t t0;
+
+        stress_fill(&s, c);
+        t0 = bench_now();
+        rtdb_adc_write(&s);
+        bench_add(&stress_writer_bench, bench_now() - t0);
+        k_busy_wait(STRESS_GAP_US);
+    }
+    atomic_set(&stress_done, 1);
+}
+
+static void stress_reader_code(void *argA, void *argB, void *argC)
+{
+    struct stress_reader *r = argA;
+    struct adc_value_container s;
+    uint32_t last = 0;
+
+    while (!atomic_get(&stress_done)) {
+        const uint64_t t0 = bench_now();
+
+        rtdb_adc_read(&s);
+        bench_add(&r->bench, bench_now() - t0);
+        r->reads++;
+        if (!stress_consistent(&s)) {
+            r->torn++;
+        }
+        if (s.seq < last) {
+            r->backwards++;
+        }
+        last = s.seq;
+        k_usleep(r->sleep_us);
+    }
+}
+
+static void *stress_setup(void)
+{
+    fixture_init();
+    return NULL;
+}
+
+ZTEST(rtdb_stress, test_rtdb_contention)
+{
+    static const char *const names[STRESS_READERS] = {
+        "rtdb_read_contended_p4", "rtdb_read_contended_p5", "rtdb_read_contended_p6",
+    };
+
+    atomic_set(&stress_done, 0);
+    bench_init(&stress_writer_bench, "rtdb_write_contended");
+    for (int r = 0; r < STRESS_READERS; r++) {
+        stress_readers[r] = (struct stress_reader){
+            .prio = STRESS_WRITER_PRIO - STRESS_READERS + r,
+            .sleep_us = 20 * (r + 1),
+        };
+        bench_init(&stress_readers[r].bench, names[r]);
+        k_thread_create(&stress_reader_data[r], stress_reader_stack[r],
+                        K_THREAD_STACK_SIZEOF(stress_reader_stack[r]), stress_reader_code,
+                        &stress_readers[r], NULL, NULL, stress_readers[r].prio, 0, K_NO_WAIT);
+    }
+    k_thread_create(&stress_writer_data, stress_writer_stack, K_THREAD_STACK_SIZEOF(stress_writer_stack),
+                    stress_writer_code, NULL, NULL, NULL, STRESS_WRITER_PRIO, 0, K_NO_WAIT);
+
+    zassert_ok(k_thread_join(&stress_writer_data, K_SECONDS(60)), "writer did not finish");
+    for (int r = 0; r < STRESS_READERS; r++) {
+        zassert_ok(k_thread_join(&stress_reader_data[r], K_SECONDS(1)));
+    }
+
+    bench_report(&stress_writer_bench);
+    for (int r = 0; r < STRESS_READERS; r++) {
+        const struct stress_reader *rd = &stress_readers[r];
+
+        bench_report(&rd->bench);
+        zassert_true(rd->reads > 0, "reader %d never ran", r);
+        zassert_equal(rd->torn, 0, "reader %d: %u torn snapshots", r, rd->torn);
+        zassert_equal(rd->backwards, 0, "reader %d: %u older snapshots", r, rd->backwards);
+    }
+}
+
+ZTEST_SUITE(rtdb_stress, NULL, stress_setup, NULL, NULL, NULL);
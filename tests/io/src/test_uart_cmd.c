@@ -0,0 +1,111 @@
+/**
+ * \file test_uart_cmd.c
+ * 
+ * \brief Command reception tests
+ * 
+ * Frames put on the RX line of the UART emulator, through the UART callback of the application
+ * (GMTjob, with its two alternating receive buffers), cmd_rx() and the command queue, to the
+ * application's command thread: the effect of a frame, a burst of frames, frames split across the
+ * receive buffers, and the latency from a frame to the end of its processing.
+ * 
+ * \version 1.0
+ * 
+ * \date 05-07-2023
+ * 
+ * \author Gonçalo Tavares 
+*/
+
+#include <zephyr/ztest.h>
+#include "fixture.h"
+#include "bench.h"
+#include "GMTcmd.h"
+#include "GMTjob.h"
+
+#define UART_CMD_RUNS 100 /**< Frames timed by the latency test */
+#define UART_CMD_MAX_US 2000 /**< Longest accepted frame to processing latency (in us) */
+
+static void *uart_cmd_setup(void)
+{
+    fixture_init();
+    return NULL;
+}
+
+static void uart_cmd_before(void *f)
+{
+    fixture_pipeline_start();
+}
+
+static void uart_cmd_after(void *f)
+{
+    fixture_pipeline_stop();
+    ptask_set_period(&task_an, 1000);
+}
+
+ZTEST(uart_cmd, test_frame_applied)
+{
+    struct fixture_cmd_done done;
+
+    fixture_send("$TI0500&");
+    zassert_ok(fixture_cmd_wait(&done, K_MSEC(100)), "frame not processed");
+    zassert_equal(done.result, 0);
+    zassert_equal(task_an.period, 500);
+
+    /* Line endings between frames are ignored */
+    fixture_send("\r\n$TI0250&\r\n");
+    zassert_ok(fixture_cmd_wait(&done, K_MSEC(100)), "frame not processed");
+    zassert_equal(done.result, 0);
+    zassert_equal(task_an.period, 250);
+}
+
+ZTEST(uart_cmd, test_frame_burst)
+{
+    const uint32_t dropped = cmd_dropped();
+    struct fixture_cmd_done done;
+
+    /* As many frames as the queue holds, in one write: none is lost */
+    fixture_send("$TI0100&$TI0200&$TI0300&$TI0400&");
+    for (int k = 0; k < CMD_QUEUE_LEN; k++) {
+        zassert_ok(fixture_cmd_wait(&done, K_MSEC(100)), "frame %d not processed", k);
+        zassert_equal(done.result, 0, "frame %d", k);
+    }
+    zassert_equal(task_an.period, 400);
+    zassert_equal(cmd_dropped(), dropped);
+}
+
+ZTEST(uart_cmd, test_frame_buffers)
+{
+    static const char pad[] = "\r\n\r\n\r\n";
+    struct fixture_cmd_done done;
+    char frame[sizeof(pad) + 8];
+
+    /* 8 to 14 bytes per frame: over three rounds of both buffers every frame starts at another
+     * offset, and some are split between the buffer that fills and the next one */
+    for (int k = 0; k < 6 * Receive_Buff_Size / 8; k++) {
+        snprintk(frame, sizeof(frame), "%.*s$TI%04d&", k % (int)(sizeof(pad) - 1), pad, 100 + k);
+        fixture_send(frame);
+        zassert_ok(fixture_cmd_wait(&done, K_MSEC(100)), "frame %d not processed", k);
+        zassert_equal(done.result, 0, "frame %d", k);
+        zassert_equal(task_an.period, 100 + k, "frame %d", k);
+    }
+}
+
+ZTEST(uart_cmd, test_frame_latency)
+{
+    struct fixture_cmd_done done;
+    struct bench b;
+
+    bench_init(&b, "uart_to_cmd");
+    for (int k = 0; k < UART_CMD_RUNS; k++) {
+        const uint32_t t0 = k_cycle_get_32();
+
+        fixture_send((k & 1) ? "$TI1000&" : "$TI0500&");
+        zassert_ok(fixture_cmd_wait(&done, K_MSEC(100)), "frame %d not processed", k);
+        zassert_equal(done.result, 0);
+        bench_add(&b, k_cyc_to_ns_floor64((uint32_t)(done.cycle - t0)));
+    }
+    bench_report(&b);
+
+    zassert_true(b.max < UART_CMD_MAX_US * NSEC_PER_USEC, "worst latency %llu ns", (unsigned long long)b.max);
+}
+
+ZTEST_SUITE(uart_cmd, NULL, uart_cmd_setup, uart_cmd_before, uart_cmd_after, NULL);